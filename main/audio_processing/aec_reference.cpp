@@ -0,0 +1,185 @@
+#include "aec_reference.h"
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "core/memory_allocator.h"
+
+// one second of history, more than window plus max delay
+#define AEC_RING_MS 1000
+// mic window correlated against the reference
+#define AEC_WINDOW_SAMPLES 4096
+// correlator runs at 4kHz, plenty for speech and 16x cheaper
+#define AEC_DECIMATION 4
+// mic gaps shorter than this are capture jitter, the stream stays contiguous
+#define AEC_MIC_JITTER_MS 20
+#define AEC_ESTIMATE_INTERVAL_MS 5000
+#define AEC_RETRY_INTERVAL_MS 500
+// below this the reference is too quiet to correlate against
+#define AEC_MIN_REF_ENERGY 1000.0f
+#define AEC_MIN_CORRELATION 0.3f
+// estimates this close to the current delay just refine it
+#define AEC_DELAY_TOLERANCE_MS 2
+
+static const char* TAG = "AecReference";
+
+AecReference::AecReference(int sample_rate, int default_delay_ms, int max_delay_ms)
+    : sample_rate_(sample_rate) {
+    ring_samples_ = sample_rate_ * AEC_RING_MS / 1000;
+    max_delay_samples_ = sample_rate_ * max_delay_ms / 1000;
+    delay_samples_ = sample_rate_ * default_delay_ms / 1000;
+    ref_ring_ = (int16_t*)psram_prefered_malloc(ring_samples_ * sizeof(int16_t));
+    mic_ring_ = (int16_t*)psram_prefered_malloc(ring_samples_ * sizeof(int16_t));
+    size_t mic_dec = AEC_WINDOW_SAMPLES / AEC_DECIMATION;
+    size_t ref_dec = (AEC_WINDOW_SAMPLES + max_delay_samples_) / AEC_DECIMATION;
+    mic_dec_ = (float*)psram_prefered_malloc(mic_dec * sizeof(float));
+    ref_dec_ = (float*)psram_prefered_malloc(ref_dec * sizeof(float));
+    ref_energy_ = (float*)psram_prefered_malloc((ref_dec + 1) * sizeof(float));
+}
+
+AecReference::~AecReference() {
+    free(ref_ring_);
+    free(mic_ring_);
+    free(mic_dec_);
+    free(ref_dec_);
+    free(ref_energy_);
+}
+
+void AecReference::Write(const int16_t* pcm, size_t samples, int64_t now_us) {
+    int64_t pos = Position(now_us);
+    if (ref_end_ < pos) {
+        // speaker ran dry, this block starts playing now
+        if (ref_end_ == ref_start_ || pos - ref_end_ >= (int64_t)ring_samples_) {
+            ref_start_ = pos;
+        } else {
+            for (int64_t p = ref_end_; p < pos; p++) {
+                ref_ring_[p % ring_samples_] = 0;
+            }
+        }
+        ref_end_ = pos;
+    }
+    // otherwise it is queued behind what is still playing
+    for (size_t i = 0; i < samples; i++) {
+        ref_ring_[(ref_end_ + i) % ring_samples_] = pcm[i];
+    }
+    ref_end_ += samples;
+    if (ref_end_ - ref_start_ > (int64_t)ring_samples_) {
+        ref_start_ = ref_end_ - ring_samples_;
+    }
+}
+
+int16_t AecReference::ReferenceAt(int64_t pos) const {
+    if (pos < ref_start_ || pos >= ref_end_) {
+        return 0;
+    }
+    return ref_ring_[pos % ring_samples_];
+}
+
+void AecReference::Interleave(const int16_t* mic, size_t samples, int64_t capture_time_us, int16_t* out) {
+    int64_t pos = Position(capture_time_us);
+    int64_t jitter = sample_rate_ * AEC_MIC_JITTER_MS / 1000;
+    if (mic_end_ == mic_start_ || llabs(pos - mic_end_) > jitter) {
+        mic_start_ = pos;
+        mic_end_ = pos;
+    }
+    int64_t ref_pos = mic_end_ - delay_samples_;
+    for (size_t i = 0; i < samples; i++) {
+        mic_ring_[(mic_end_ + i) % ring_samples_] = mic[i];
+        out[i * 2] = mic[i];
+        out[i * 2 + 1] = ReferenceAt(ref_pos + i);
+    }
+    mic_end_ += samples;
+    if (mic_end_ - mic_start_ > (int64_t)ring_samples_) {
+        mic_start_ = mic_end_ - ring_samples_;
+    }
+    MaybeEstimateDelay(capture_time_us);
+}
+
+void AecReference::MaybeEstimateDelay(int64_t now_us) {
+    if (now_us < next_estimate_us_) {
+        return;
+    }
+    // needs a full window of mic and the reference that could have caused it
+    int64_t window_start = mic_end_ - AEC_WINDOW_SAMPLES;
+    if (window_start < mic_start_ || window_start - max_delay_samples_ < ref_start_ || ref_end_ <= window_start) {
+        return;
+    }
+    int delay = 0;
+    float correlation = 0;
+    if (!EstimateDelay(&delay, &correlation)) {
+        next_estimate_us_ = now_us + AEC_RETRY_INTERVAL_MS * 1000;
+        return;
+    }
+    next_estimate_us_ = now_us + AEC_ESTIMATE_INTERVAL_MS * 1000;
+    estimates_++;
+    last_correlation_ = correlation * 100;
+    int tolerance = sample_rate_ * AEC_DELAY_TOLERANCE_MS / 1000;
+    if (estimates_ == 1) {
+        delay_samples_ = delay;
+    } else if (abs(delay - delay_samples_) <= tolerance) {
+        delay_samples_ = (delay_samples_ * 3 + delay) / 4;
+    } else if (candidate_samples_ >= 0 && abs(delay - candidate_samples_) <= tolerance) {
+        // confirmed twice, the path really changed
+        delay_samples_ = delay;
+    } else {
+        candidate_samples_ = delay;
+        return;
+    }
+    candidate_samples_ = -1;
+    ESP_LOGI(TAG, "speaker to mic delay: %d ms, correlation: %d%%", GetDelayMs(), last_correlation_);
+}
+
+bool AecReference::EstimateDelay(int* delay_samples, float* correlation) {
+    const int n = AEC_WINDOW_SAMPLES / AEC_DECIMATION;
+    const int lags = max_delay_samples_ / AEC_DECIMATION;
+    // mic window and the reference from max delay before it, box filtered and decimated
+    int64_t mic_pos = mic_end_ - AEC_WINDOW_SAMPLES;
+    int64_t ref_pos = mic_pos - lags * AEC_DECIMATION;
+    float mic_energy = 0;
+    for (int k = 0; k < n; k++) {
+        int32_t sum = 0;
+        for (int j = 0; j < AEC_DECIMATION; j++) {
+            sum += mic_ring_[(mic_pos + k * AEC_DECIMATION + j) % ring_samples_];
+        }
+        mic_dec_[k] = sum / (float)AEC_DECIMATION;
+        mic_energy += mic_dec_[k] * mic_dec_[k];
+    }
+    ref_energy_[0] = 0;
+    for (int k = 0; k < n + lags; k++) {
+        int32_t sum = 0;
+        for (int j = 0; j < AEC_DECIMATION; j++) {
+            sum += ReferenceAt(ref_pos + k * AEC_DECIMATION + j);
+        }
+        ref_dec_[k] = sum / (float)AEC_DECIMATION;
+        // prefix sums, energy of any window is a subtraction
+        ref_energy_[k + 1] = ref_energy_[k] + ref_dec_[k] * ref_dec_[k];
+    }
+    if (ref_energy_[n + lags] < AEC_MIN_REF_ENERGY * (n + lags) || mic_energy <= 0) {
+        return false;
+    }
+    // lag l pairs mic k with reference k + lags - l
+    float best = 0;
+    int best_lag = -1;
+    for (int l = 0; l <= lags; l++) {
+        const float* ref = ref_dec_ + lags - l;
+        float energy = ref_energy_[lags - l + n] - ref_energy_[lags - l];
+        if (energy < AEC_MIN_REF_ENERGY * n) {
+            continue;
+        }
+        float sum = 0;
+        for (int k = 0; k < n; k++) {
+            sum += mic_dec_[k] * ref[k];
+        }
+        float c = sum / sqrtf(mic_energy * energy);
+        if (c > best) {
+            best = c;
+            best_lag = l;
+        }
+    }
+    *correlation = best;
+    if (best_lag < 0 || best < AEC_MIN_CORRELATION) {
+        return false;
+    }
+    *delay_samples = best_lag * AEC_DECIMATION;
+    return true;
+}
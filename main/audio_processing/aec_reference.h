@@ -0,0 +1,54 @@
+#ifndef AEC_REFERENCE_H
+#define AEC_REFERENCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Speaker reference for AEC, time aligned with the mic.
+// Reference and mic samples are kept in rings indexed by their sample position on the
+// esp_timer clock, so the reference for a mic sample is simply the one played delay
+// earlier. delay covers i2s dma, codec and the air path and is found by cross correlating
+// mic and reference, once reference starts and then periodically while it keeps playing.
+// Single threaded, used by the audio task only.
+class AecReference {
+public:
+    AecReference(int sample_rate = 16000, int default_delay_ms = 40, int max_delay_ms = 200);
+    ~AecReference();
+    // pcm at sample_rate handed to the speaker at now_us, plays right after what is still queued
+    void Write(const int16_t* pcm, size_t samples, int64_t now_us);
+    // mic pcm whose first sample was captured at capture_time_us, out gets samples MR pairs
+    void Interleave(const int16_t* mic, size_t samples, int64_t capture_time_us, int16_t* out);
+    int GetDelayMs() const { return delay_samples_ * 1000 / sample_rate_; }
+    uint32_t GetEstimateCount() const { return estimates_; }
+    // best normalized correlation of the last estimate, in percent
+    int GetLastCorrelation() const { return last_correlation_; }
+
+private:
+    int64_t Position(int64_t time_us) const { return time_us * sample_rate_ / 1000000; }
+    int16_t ReferenceAt(int64_t pos) const;
+    void MaybeEstimateDelay(int64_t now_us);
+    bool EstimateDelay(int* delay_samples, float* correlation);
+
+    int sample_rate_;
+    size_t ring_samples_;
+    int max_delay_samples_;
+    int delay_samples_;
+    int16_t* ref_ring_ = nullptr;
+    int16_t* mic_ring_ = nullptr;
+    // positions, [ref_start_, ref_end_) holds reference, silence included
+    int64_t ref_start_ = 0;
+    int64_t ref_end_ = 0;
+    int64_t mic_start_ = 0;
+    int64_t mic_end_ = 0;
+    // decimated scratch of the correlator
+    float* mic_dec_ = nullptr;
+    float* ref_dec_ = nullptr;
+    float* ref_energy_ = nullptr;
+    int64_t next_estimate_us_ = 0;
+    // disagreeing estimate waiting for a confirmation
+    int candidate_samples_ = -1;
+    uint32_t estimates_ = 0;
+    int last_correlation_ = 0;
+};
+
+#endif
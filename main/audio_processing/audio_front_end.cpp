@@ -0,0 +1,167 @@
+#include "audio_front_end.h"
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+#include <string.h>
+#include <string>
+
+#define FRONT_END_RUNNING 0x01
+
+static const char* TAG = "AudioFrontEnd";
+
+AudioFrontEnd::AudioFrontEnd() {
+    event_group_ = xEventGroupCreate();
+}
+
+AudioFrontEnd::~AudioFrontEnd() {
+    if (afe_data_ != nullptr) {
+        afe_iface_->destroy(afe_data_);
+    }
+    vEventGroupDelete(event_group_);
+}
+
+srmodel_list_t* AudioFrontEnd::Models() {
+    static srmodel_list_t* models = esp_srmodel_init("model");
+    return models;
+}
+
+void AudioFrontEnd::Initialize(int channels, bool reference) {
+    channels_ = channels;
+    reference_ = reference;
+    srmodel_list_t* models = Models();
+    if (!models || models->num <= 0) {
+        ESP_LOGE(TAG, "Failed to load models at partition: model");
+        return;
+    }
+    size_t psram_before = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+    size_t internal_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+
+    int ref_num = reference_ ? 1 : 0;
+    std::string input_format;
+    for (int i = 0; i < channels_ - ref_num; i++) {
+        input_format.push_back('M');
+    }
+    for (int i = 0; i < ref_num; i++) {
+        input_format.push_back('R');
+    }
+    afe_config_t* afe_config = afe_config_init(input_format.c_str(), models, AFE_TYPE_SR, AFE_MODE_HIGH_PERF);
+    afe_config->aec_init = reference_;
+    // sr front end, the aec mode has to be one of the sr ones
+    afe_config->aec_mode = AEC_MODE_SR_LOW_COST;
+    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
+    afe_config->ns_init = ns_model_name != NULL;
+    afe_config->ns_model_name = ns_model_name;
+    afe_config->afe_ns_mode = AFE_NS_MODE_NET;
+    afe_config->vad_init = true;
+    afe_config->vad_mode = VAD_MODE_0;
+    afe_config->vad_min_noise_ms = 100;
+    afe_config->agc_init = false;
+    afe_config->wakenet_mode = DET_MODE_95;
+    afe_config->afe_perferred_core = 1;
+    afe_config->afe_perferred_priority = 1;
+    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
+
+    afe_iface_ = esp_afe_handle_from_config(afe_config);
+    afe_data_ = afe_iface_->create_from_config(afe_config);
+    // wakenet only runs while the detector wants it
+    afe_iface_->disable_wakenet(afe_data_);
+
+    // sinks run on this task, wake word sink encodes the pre-roll so it needs a big stack
+    xTaskCreateWithCaps([](void* arg) {
+        auto this_ = (AudioFrontEnd*)arg;
+        this_->FetchTask();
+        vTaskDelete(NULL);
+    }, "audio_front_end", 4096 * 8, this, 3, nullptr, MALLOC_CAP_SPIRAM);
+
+    ESP_LOGI(TAG, "AFE %s aec: %d ns: %s, psram used: %u internal used: %u", input_format.c_str(), reference_,
+        ns_model_name ? ns_model_name : "off",
+        (unsigned)(psram_before - heap_caps_get_free_size(MALLOC_CAP_SPIRAM)),
+        (unsigned)(internal_before - heap_caps_get_free_size(MALLOC_CAP_INTERNAL)));
+}
+
+void AudioFrontEnd::Feed(const int16_t* data, size_t samples) {
+    if (!afe_iface_) {
+        ESP_LOGE(TAG, "AFE interface not initialized");
+        return;
+    }
+    size_t feed_size = afe_iface_->get_feed_chunksize(afe_data_) * channels_;
+    if (input_buffer_.size() != feed_size) {
+        input_buffer_.resize(feed_size);
+        input_fill_ = 0;
+    }
+    const int16_t* src = data;
+    size_t remain = samples;
+    while (remain > 0) {
+        if (input_fill_ == 0 && remain >= feed_size) {
+            // whole chunks go to AFE straight from the mic block
+            afe_iface_->feed(afe_data_, src);
+            src += feed_size;
+            remain -= feed_size;
+            continue;
+        }
+        // top up the partial chunk, nothing is ever shifted
+        size_t n = feed_size - input_fill_;
+        if (n > remain)
+            n = remain;
+        memcpy(input_buffer_.data() + input_fill_, src, n * sizeof(int16_t));
+        input_fill_ += n;
+        src += n;
+        remain -= n;
+        if (input_fill_ == feed_size) {
+            afe_iface_->feed(afe_data_, input_buffer_.data());
+            input_fill_ = 0;
+        }
+    }
+}
+
+bool AudioFrontEnd::IsRunning() {
+    return xEventGroupGetBits(event_group_) & FRONT_END_RUNNING;
+}
+
+void AudioFrontEnd::EnableWakeWord(bool enable) {
+    if (!afe_iface_) {
+        return;
+    }
+    wake_word_enabled_ = enable;
+    if (enable)
+        afe_iface_->enable_wakenet(afe_data_);
+    else
+        afe_iface_->disable_wakenet(afe_data_);
+    UpdateRunning();
+}
+
+void AudioFrontEnd::EnableOutput(bool enable) {
+    output_enabled_ = enable;
+    UpdateRunning();
+}
+
+void AudioFrontEnd::UpdateRunning() {
+    if (wake_word_enabled_ || output_enabled_) {
+        xEventGroupSetBits(event_group_, FRONT_END_RUNNING);
+    } else {
+        xEventGroupClearBits(event_group_, FRONT_END_RUNNING);
+        if (afe_data_ != nullptr) {
+            afe_iface_->reset_buffer(afe_data_);
+        }
+    }
+}
+
+void AudioFrontEnd::FetchTask() {
+    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
+    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
+    ESP_LOGI(TAG, "Audio front end task started, feed size: %d fetch size: %d",
+        feed_size, fetch_size);
+
+    while (true) {
+        xEventGroupWaitBits(event_group_, FRONT_END_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
+        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
+        if (res == nullptr || res->ret_value == ESP_FAIL) {
+            continue;
+        }
+        if (wake_word_enabled_ && wake_word_sink_) {
+            wake_word_sink_(res);
+        }
+        if (output_enabled_ && output_sink_) {
+            output_sink_(res);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef AUDIO_FRONT_END_H
+#define AUDIO_FRONT_END_H
+
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/event_groups.h>
+
+#include <vector>
+#include <atomic>
+#include <functional>
+
+// The single AFE instance of the device. Mic(+reference) pcm is fed once, AEC, noise
+// suppression, VAD and wakenet run once, and every fetched chunk goes to the wake word
+// detector and to the uplink processor, whichever of them is enabled.
+class AudioFrontEnd {
+public:
+    using FetchSink = std::function<void(const afe_fetch_result_t* res)>;
+
+    AudioFrontEnd();
+    ~AudioFrontEnd();
+    // model list of the "model" partition, loaded once and shared by everything using esp-sr
+    static srmodel_list_t* Models();
+
+    // channels includes the reference channel when reference is true
+    void Initialize(int channels, bool reference);
+    // interleaved samples of any length, handed to AFE in whole feed chunks
+    void Feed(const int16_t* data, size_t samples);
+    bool HasReference() const { return reference_; }
+    int GetChannels() const { return channels_; }
+    // true while any sink is enabled, no need to feed otherwise
+    bool IsRunning();
+
+    void SetWakeWordSink(FetchSink sink) { wake_word_sink_ = sink; }
+    void SetOutputSink(FetchSink sink) { output_sink_ = sink; }
+    void EnableWakeWord(bool enable);
+    void EnableOutput(bool enable);
+private:
+    void UpdateRunning();
+    void FetchTask();
+
+    esp_afe_sr_iface_t* afe_iface_ = nullptr;
+    esp_afe_sr_data_t* afe_data_ = nullptr;
+    EventGroupHandle_t event_group_ = nullptr;
+    int channels_ = 1;
+    bool reference_ = false;
+    // exactly one feed chunk, filled without shifting
+    std::vector<int16_t> input_buffer_;
+    size_t input_fill_ = 0;
+    FetchSink wake_word_sink_;
+    FetchSink output_sink_;
+    std::atomic<bool> wake_word_enabled_{false};
+    std::atomic<bool> output_enabled_{false};
+};
+
+#endif
@@ -1,95 +1,42 @@
 #include "audio_processor.h"
+#include "audio_front_end.h"
 #include <esp_log.h>
 
 #define PROCESSOR_RUNNING 0x01
 
 static const char* TAG = "AudioProcessor";
 
-AudioProcessor::AudioProcessor()
-    : afe_data_(nullptr) {
+AudioProcessor::AudioProcessor() {
     event_group_ = xEventGroupCreate();
 }
 
-void AudioProcessor::Initialize(int channels, bool realtime_chat) {
-    channels_ = channels;
-    if (realtime_chat) {
-        channels_ = 2;
-    }
-    // codec_ = codec;
-    int ref_num = realtime_chat ? 1 : 0;
-    std::string input_format;
-    for (int i = 0; i < channels_ - ref_num; i++) {
-        input_format.push_back('M');
-    }
-    for (int i = 0; i < ref_num; i++) {
-        input_format.push_back('R');
-    }
-
-    srmodel_list_t *models = esp_srmodel_init("model");
-    char* ns_model_name = esp_srmodel_filter(models, ESP_NSNET_PREFIX, NULL);
-
-    afe_config_t* afe_config = afe_config_init(input_format.c_str(), NULL, AFE_TYPE_VC, AFE_MODE_HIGH_PERF);
-    if (realtime_chat) {
-        afe_config->aec_init = true;
-        afe_config->aec_mode = AEC_MODE_VOIP_HIGH_PERF;
-    } else {
-        afe_config->aec_init = false;
-    }
-    afe_config->ns_init = true;
-    afe_config->ns_model_name = ns_model_name;
-    afe_config->afe_ns_mode = AFE_NS_MODE_NET;
-    if (realtime_chat) {
-        afe_config->vad_init = false;
-    } else {
-        afe_config->vad_init = true;
-        afe_config->vad_mode = VAD_MODE_0;
-        afe_config->vad_min_noise_ms = 100;
-    }
-    afe_config->afe_perferred_core = 1;
-    afe_config->afe_perferred_priority = 1;
-    afe_config->agc_init = false;
-    afe_config->memory_alloc_mode = AFE_MEMORY_ALLOC_MORE_PSRAM;
-
-    afe_iface_ = esp_afe_handle_from_config(afe_config);
-    afe_data_ = afe_iface_->create_from_config(afe_config);
-    xTaskCreateWithCaps([](void* arg) {
-        auto this_ = (AudioProcessor*)arg;
-        this_->AudioProcessorTask();
-        vTaskDelete(NULL);
-    }, "audio_communication", 4096 * 8, this, 3, NULL, MALLOC_CAP_SPIRAM);
+void AudioProcessor::Initialize(AudioFrontEnd* front_end) {
+    front_end_ = front_end;
+    front_end_->SetOutputSink([this](const afe_fetch_result_t* res) {
+        OnFetch(res);
+    });
 }
 
 AudioProcessor::~AudioProcessor() {
-    if (afe_data_ != nullptr) {
-        afe_iface_->destroy(afe_data_);
-    }
     vEventGroupDelete(event_group_);
 }
 
-size_t AudioProcessor::GetFeedSize() {
-    return afe_iface_->get_feed_chunksize(afe_data_) * channels_;
-}
-
-void AudioProcessor::Feed(const std::vector<int16_t>& data) {
-    afe_iface_->feed(afe_data_, data.data());
-}
-
 void AudioProcessor::Start() {
     xEventGroupSetBits(event_group_, PROCESSOR_RUNNING);
+    front_end_->EnableOutput(true);
 }
 
 void AudioProcessor::Stop() {
     xEventGroupClearBits(event_group_, PROCESSOR_RUNNING);
-    if (afe_data_ != nullptr) {
-        afe_iface_->reset_buffer(afe_data_);
-    }
+    front_end_->EnableOutput(false);
+    is_speaking_ = false;
 }
 
 bool AudioProcessor::IsRunning() {
     return xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING;
 }
 
-void AudioProcessor::OnOutput(std::function<void(std::vector<int16_t>&& data)> callback) {
+void AudioProcessor::OnOutput(std::function<void(PcmBlockRef&& data)> callback) {
     output_callback_ = callback;
 }
 
@@ -97,39 +44,19 @@ void AudioProcessor::OnVadStateChange(std::function<void(bool speaking)> callbac
     vad_state_change_callback_ = callback;
 }
 
-void AudioProcessor::AudioProcessorTask() {
-    auto fetch_size = afe_iface_->get_fetch_chunksize(afe_data_);
-    auto feed_size = afe_iface_->get_feed_chunksize(afe_data_);
-    printf("Audio communication task started, feed size: %d fetch size: %d",
-        feed_size, fetch_size);
-
-    while (true) {
-        xEventGroupWaitBits(event_group_, PROCESSOR_RUNNING, pdFALSE, pdTRUE, portMAX_DELAY);
-
-        auto res = afe_iface_->fetch_with_delay(afe_data_, portMAX_DELAY);
-        if ((xEventGroupGetBits(event_group_) & PROCESSOR_RUNNING) == 0) {
-            continue;
-        }
-        if (res == nullptr || res->ret_value == ESP_FAIL) {
-            if (res != nullptr) {
-                printf("Error code: %d", res->ret_value);
-            }
-            continue;
-        }
-
-        // VAD state change
-        if (vad_state_change_callback_) {
-            if (res->vad_state == VAD_SPEECH && !is_speaking_) {
-                is_speaking_ = true;
-                vad_state_change_callback_(true);
-            } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
-                is_speaking_ = false;
-                vad_state_change_callback_(false);
-            }
-        }
+void AudioProcessor::OnFetch(const afe_fetch_result_t* res) {
+    // VAD state change
+    if (res->vad_state == VAD_SPEECH && !is_speaking_) {
+        is_speaking_ = true;
+        if (vad_state_change_callback_)
+            vad_state_change_callback_(true);
+    } else if (res->vad_state == VAD_SILENCE && is_speaking_) {
+        is_speaking_ = false;
+        if (vad_state_change_callback_)
+            vad_state_change_callback_(false);
+    }
 
-        if (output_callback_) {
-            output_callback_(std::vector<int16_t>(res->data, res->data + res->data_size / sizeof(int16_t)));
-        }
+    if (output_callback_) {
+        output_callback_(PcmBlockPool::Shared().Acquire(res->data, res->data_size / sizeof(int16_t)));
     }
 }
@@ -9,34 +9,34 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include "pcm_block_pool.h"
 
-// #include "audio_codec.h"
+class AudioFrontEnd;
 
+// Uplink side of the shared front end: hands out processed pcm and vad changes while started
 class AudioProcessor {
 public:
     AudioProcessor();
     ~AudioProcessor();
 
-    void Initialize(int channels, bool realtime_chat);
-    void Feed(const std::vector<int16_t>& data);
+    void Initialize(AudioFrontEnd* front_end);
     void Start();
     void Stop();
     bool IsRunning();
-    void OnOutput(std::function<void(std::vector<int16_t>&& data)> callback);
+    // vad state of the last output block, read from the output callback
+    bool IsSpeaking() const { return is_speaking_; }
+    // output block comes from the shared pool, keep the ref as long as needed
+    void OnOutput(std::function<void(PcmBlockRef&& data)> callback);
     void OnVadStateChange(std::function<void(bool speaking)> callback);
-    size_t GetFeedSize();
 
 private:
     EventGroupHandle_t event_group_ = nullptr;
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
-    std::function<void(std::vector<int16_t>&& data)> output_callback_;
+    AudioFrontEnd* front_end_ = nullptr;
+    std::function<void(PcmBlockRef&& data)> output_callback_;
     std::function<void(bool speaking)> vad_state_change_callback_;
-    // AudioCodec* codec_ = nullptr;
-    int channels_ = 0;
     bool is_speaking_ = false;
 
-    void AudioProcessorTask();
+    void OnFetch(const afe_fetch_result_t* res);
 };
 
 #endif
@@ -0,0 +1,48 @@
+#include "endpointer.h"
+
+Endpointer::Endpointer(int hangover_ms, int min_speech_ms)
+    : hangover_ms_(hangover_ms), min_speech_ms_(min_speech_ms) {
+}
+
+void Endpointer::Reset() {
+    in_utterance_ = false;
+    speech_ms_ = 0;
+    silence_ms_ = 0;
+}
+
+EndpointEvent Endpointer::Process(bool speech, int duration_ms, int64_t now_us) {
+    if (!in_utterance_) {
+        if (!speech) {
+            speech_ms_ = 0;
+            return ENDPOINT_NONE;
+        }
+        if (speech_ms_ == 0) {
+            speech_start_us_ = now_us - duration_ms * 1000;
+        }
+        speech_ms_ += duration_ms;
+        if (speech_ms_ < min_speech_ms_) {
+            return ENDPOINT_NONE;
+        }
+        in_utterance_ = true;
+        speech_ms_ = 0;
+        silence_ms_ = 0;
+        speech_end_us_ = now_us;
+        last_.start_us = speech_start_us_;
+        last_.end_us = 0;
+        return ENDPOINT_SPEECH_START;
+    }
+    if (speech) {
+        silence_ms_ = 0;
+        speech_end_us_ = now_us;
+        return ENDPOINT_NONE;
+    }
+    silence_ms_ += duration_ms;
+    if (silence_ms_ < hangover_ms_) {
+        return ENDPOINT_NONE;
+    }
+    in_utterance_ = false;
+    silence_ms_ = 0;
+    last_.end_us = speech_end_us_;
+    count_++;
+    return ENDPOINT_SPEECH_END;
+}
@@ -0,0 +1,45 @@
+#ifndef ENDPOINTER_H
+#define ENDPOINTER_H
+
+#include <stdint.h>
+
+enum EndpointEvent {
+    ENDPOINT_NONE = 0,
+    // speech lasted min speech, utterance begins where that speech began
+    ENDPOINT_SPEECH_START,
+    // silence lasted the hangover, utterance ends where the speech ended
+    ENDPOINT_SPEECH_END
+};
+
+struct Utterance {
+    int64_t start_us = 0;
+    int64_t end_us = 0;
+};
+
+// Turns the per chunk vad decision into utterance boundaries.
+// Speech shorter than min speech is a click, silence shorter than the hangover is a pause.
+class Endpointer {
+public:
+    Endpointer(int hangover_ms = 600, int min_speech_ms = 120);
+    void SetHangover(int hangover_ms) { hangover_ms_ = hangover_ms; }
+    void Reset();
+    // vad decision for duration_ms of audio ending at now_us
+    EndpointEvent Process(bool speech, int duration_ms, int64_t now_us);
+    bool InUtterance() const { return in_utterance_; }
+    const Utterance& GetLastUtterance() const { return last_; }
+    uint32_t GetUtteranceCount() const { return count_; }
+
+private:
+    int hangover_ms_;
+    int min_speech_ms_;
+    bool in_utterance_ = false;
+    // consecutive speech before the utterance, consecutive silence inside it
+    int speech_ms_ = 0;
+    int silence_ms_ = 0;
+    int64_t speech_start_us_ = 0;
+    int64_t speech_end_us_ = 0;
+    Utterance last_;
+    uint32_t count_ = 0;
+};
+
+#endif
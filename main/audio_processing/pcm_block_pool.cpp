@@ -0,0 +1,123 @@
+#include "pcm_block_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "core/memory_allocator.h"
+
+// 16 blocks of 4096 samples, enough for a 60ms frame at 48kHz or an interleaved AEC chunk
+#define SHARED_POOL_BLOCKS 16
+#define SHARED_POOL_BLOCK_SAMPLES 4096
+
+PcmBlockRef::PcmBlockRef(PcmBlock* block) : block_(block) {
+    if (block_)
+        block_->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+PcmBlockRef::PcmBlockRef(const PcmBlockRef& other) : PcmBlockRef(other.block_) {
+}
+
+PcmBlockRef::PcmBlockRef(PcmBlockRef&& other) noexcept : block_(other.block_) {
+    other.block_ = nullptr;
+}
+
+PcmBlockRef& PcmBlockRef::operator=(const PcmBlockRef& other) {
+    if (this != &other) {
+        reset();
+        block_ = other.block_;
+        if (block_)
+            block_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return *this;
+}
+
+PcmBlockRef& PcmBlockRef::operator=(PcmBlockRef&& other) noexcept {
+    if (this != &other) {
+        reset();
+        block_ = other.block_;
+        other.block_ = nullptr;
+    }
+    return *this;
+}
+
+PcmBlockRef::~PcmBlockRef() {
+    reset();
+}
+
+void PcmBlockRef::reset() {
+    if (block_ && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block_->pool->Release(block_);
+    }
+    block_ = nullptr;
+}
+
+PcmBlockPool::PcmBlockPool(uint16_t block_count, size_t block_samples)
+    : blocks_(block_count), block_samples_(block_samples) {
+    storage_ = (int16_t*)psram_prefered_malloc(block_count * block_samples * sizeof(int16_t));
+    assert(storage_);
+    free_blocks_.reserve(block_count);
+    for (size_t i = 0; i < block_count; i++) {
+        auto& block = blocks_[i];
+        block.data = storage_ + i * block_samples;
+        block.capacity = block_samples;
+        block.pool = this;
+        free_blocks_.push_back(&block);
+    }
+}
+
+PcmBlockPool::~PcmBlockPool() {
+    free(storage_);
+}
+
+PcmBlockPool& PcmBlockPool::Shared() {
+    static PcmBlockPool pool(SHARED_POOL_BLOCKS, SHARED_POOL_BLOCK_SAMPLES);
+    return pool;
+}
+
+PcmBlockRef PcmBlockPool::Acquire(size_t samples) {
+    PcmBlock* block = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.acquired++;
+        if (samples <= block_samples_ && !free_blocks_.empty()) {
+            block = free_blocks_.back();
+            free_blocks_.pop_back();
+            stats_.in_use++;
+            if (stats_.in_use > stats_.peak)
+                stats_.peak = stats_.in_use;
+        } else {
+            stats_.heap_allocs++;
+        }
+    }
+    if (!block) {
+        // never fail the audio path, fall back to the heap and let the counter tell
+        block = new PcmBlock();
+        block->data = (int16_t*)psram_prefered_malloc(samples * sizeof(int16_t));
+        block->capacity = samples;
+        block->pool = this;
+        block->heap = true;
+    }
+    block->size = samples;
+    return PcmBlockRef(block);
+}
+
+PcmBlockRef PcmBlockPool::Acquire(const int16_t* pcm, size_t samples) {
+    auto block = Acquire(samples);
+    memcpy(block.data(), pcm, samples * sizeof(int16_t));
+    return block;
+}
+
+PcmPoolStats PcmBlockPool::GetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+void PcmBlockPool::Release(PcmBlock* block) {
+    if (block->heap) {
+        free(block->data);
+        delete block;
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_blocks_.push_back(block);
+    stats_.in_use--;
+}
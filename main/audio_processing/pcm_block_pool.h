@@ -0,0 +1,77 @@
+#ifndef PCM_BLOCK_POOL_H
+#define PCM_BLOCK_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+class PcmBlockPool;
+
+struct PcmBlock {
+    int16_t* data = nullptr;
+    size_t capacity = 0;
+    size_t size = 0;
+    std::atomic<uint16_t> refs{0};
+    PcmBlockPool* pool = nullptr;
+    // allocated on demand because pool was empty or block too small, freed on last release
+    bool heap = false;
+};
+
+// Refcounted view of a pooled pcm block. Copies share the block, the block goes back
+// to its pool when the last view is gone, so one buffer can fan out to several consumers.
+class PcmBlockRef {
+public:
+    PcmBlockRef() = default;
+    explicit PcmBlockRef(PcmBlock* block);
+    PcmBlockRef(const PcmBlockRef& other);
+    PcmBlockRef(PcmBlockRef&& other) noexcept;
+    PcmBlockRef& operator=(const PcmBlockRef& other);
+    PcmBlockRef& operator=(PcmBlockRef&& other) noexcept;
+    ~PcmBlockRef();
+
+    int16_t* data() const { return block_ ? block_->data : nullptr; }
+    size_t size() const { return block_ ? block_->size : 0; }
+    size_t capacity() const { return block_ ? block_->capacity : 0; }
+    // only the producer sets the size, before handing out copies
+    void resize(size_t samples) { block_->size = samples; }
+    explicit operator bool() const { return block_ != nullptr; }
+    void reset();
+private:
+    PcmBlock* block_ = nullptr;
+};
+
+struct PcmPoolStats {
+    uint32_t acquired = 0;
+    // acquires the pool couldn't serve, each one is a heap allocation
+    uint32_t heap_allocs = 0;
+    uint16_t in_use = 0;
+    uint16_t peak = 0;
+};
+
+// Fixed set of pcm blocks preallocated in PSRAM, shared by mic, AFE, AEC reference and playback.
+class PcmBlockPool {
+public:
+    PcmBlockPool(uint16_t block_count, size_t block_samples);
+    ~PcmBlockPool();
+    static PcmBlockPool& Shared();
+
+    // block of at least samples capacity with size set to samples
+    PcmBlockRef Acquire(size_t samples);
+    // copy of pcm in a pooled block
+    PcmBlockRef Acquire(const int16_t* pcm, size_t samples);
+    PcmPoolStats GetStats();
+private:
+    friend class PcmBlockRef;
+    void Release(PcmBlock* block);
+
+    std::vector<PcmBlock> blocks_;
+    std::vector<PcmBlock*> free_blocks_;
+    int16_t* storage_ = nullptr;
+    size_t block_samples_;
+    std::mutex mutex_;
+    PcmPoolStats stats_;
+};
+
+#endif
@@ -9,14 +9,31 @@
 #include <mbedtls/base64.h>
 #include "../rpc/msg.pb-c.h"
 #include "../proto_socket.h"
+#include "esp_timer.h"
 
 #define FG_TASK_EVENT (1 << 0)
-#define AUDIO_TASK_EVENT (1 << 1)
-#define STOP_SPEAK_EVENT (1 << 2)
+// audio task saw the last tts sample leave the speaker
+#define PLAYBACK_DONE_EVENT (1 << 2)
+// audio task notification bits
+#define AUDIO_NOTIFY_TASK (1 << 0)
+#define AUDIO_NOTIFY_PACKET (1 << 1)
+#define AUDIO_NOTIFY_STATE (1 << 2)
+// mic driver has no completion callback, its dma period is what wakes the audio task while mic is consumed
+#define AUDIO_MIC_PERIOD_MS 10
+// time a drain of the task queues may take, the rest runs on the next frame / wake up
+#define FG_TASK_BUDGET_US 5000
+#define AUDIO_TASK_BUDGET_US 2000
+#define PING_INTERVAL_MS 5000
+// decoded frames kept ahead of the speaker
+#define DECODE_AHEAD_FRAMES 4
+// decoder is woken when playback leaves this many frames or fewer in the ring
+#define DECODE_LOW_WATER_FRAMES 2
+// a full jitter buffer holds the recv task this long for playback to make room, then the frame is dropped
+#define JITTER_FULL_WAIT_MS 2000
+#define JITTER_FULL_POLL_MS 20
 #define LANG_CN "zh-CN"
 #define BOARD_TYPE "bread-compact-wifi"
 #define BOARD_NAME BOARD_TYPE
-#define LOCK_OPUS_BUFFER std::lock_guard<std::recursive_mutex> lock(m_opusMutex);
 
 
 std::string session_id = "";
@@ -24,30 +41,48 @@ std::string session_id = "";
 BigMouthAI::BigMouthAI()
 {
     m_eventGroup = xEventGroupCreate();
-    m_wakeWordDetect.Initialize(1, false);
+    // one AFE for wake word and uplink, mic is fed once and processed once
 #ifdef CONFIG_AUDIO_PROCESSING
-    m_audioProcessor.Initialize(2, true);
-    m_loopbackBuffer.allocate(1024 * 2);
+    m_frontEnd.Initialize(2, true);
+#else
+    m_frontEnd.Initialize(1, false);
+#endif
+    m_wakeWordDetect.Initialize(&m_frontEnd);
+#ifdef CONFIG_AUDIO_PROCESSING
+    m_audioProcessor.Initialize(&m_frontEnd);
 #endif
-    registerRpcHandler();
     m_pMcpServer = new MCPServer();
+    // keep alive, also measures rtt for the uplink rate control
+    TimerWheel::shared().start();
+    TimerWheel::shared().schedule(PING_INTERVAL_MS, [this]() {
+        auto socket = m_pSocket;
+        if (socket) {
+            socket->ping();
+        }
+    }, PING_INTERVAL_MS);
 }
 
 BigMouthAI::~BigMouthAI()
 {
-#ifdef CONFIG_AUDIO_PROCESSING
-    m_loopbackBuffer.release();
-#endif
     vEventGroupDelete(m_eventGroup);
     delete m_pMcpServer;
 }
 void AudioTask(void* param) {
     auto ai = (BigMouthAI*)param;
+    // tasks queued before this task existed
+    xTaskNotify(xTaskGetCurrentTaskHandle(), AUDIO_NOTIFY_TASK, eSetBits);
     while (true)
     {
         ai->audioLoop();
     }
 }
+void DecodeTask(void* param) {
+    auto ai = (BigMouthAI*)param;
+    while (true)
+    {
+        ai->decodeLoop();
+    }
+}
 void BigMouthAI::onBeginConnect() {
 
 }
@@ -57,11 +92,15 @@ void BigMouthAI::onConnected(Socket* socket) {
     m_pMcpServer->setSocket(m_pSocket);
     if (!m_audioTaskHandle)
         xTaskCreatePinnedToCoreWithCaps(AudioTask, "Audio Task", 1024*32, this, 1, &m_audioTaskHandle, getSubCoreId(), MALLOC_CAP_SPIRAM);
+    // not pinned, decodes ahead on whichever core is idle while playback only copies pcm out of the ring
+    if (!m_decodeTaskHandle)
+        xTaskCreateWithCaps(DecodeTask, "Decode Task", 1024*24, this, 2, &m_decodeTaskHandle, MALLOC_CAP_SPIRAM);
     Rpc__Login login = RPC__LOGIN__INIT;
     login.accounttype = RPC__ACCOUNT_TYPE__Guest;
     login.has_accounttype = 1;
     login.name = (const char*)"isaac";
     m_pSocket->send("login", &login);
+    sendHello();
 }
 
 void BigMouthAI::onDisconnected() {
@@ -74,17 +113,57 @@ void BigMouthAI::onDisconnected() {
 
 void BigMouthAI::onBinaryData(const char* data, unsigned int len) {
     if (getState() == Speaking) {
-        LOCK_OPUS_BUFFER
-        m_opusBufferQueue.emplace_back(std::move(std::vector<uint8_t>((uint8_t*)data, (uint8_t*)data + len)));
+        int64_t now = esp_timer_get_time();
+        int64_t speechEnd = m_utteranceEndTime.exchange(0);
+        if (speechEnd) {
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            m_speechEndToTts.add(now - speechEnd);
+        }
+        if (m_nFramesPerPacket > 1) {
+            // batched message: (length(2 bytes, big endian) | opus frame)*
+            const uint8_t* p = (const uint8_t*)data;
+            const uint8_t* end = p + len;
+            while (end - p >= 2) {
+                size_t frameLen = (p[0] << 8) | p[1];
+                p += 2;
+                if (frameLen > (size_t)(end - p)) {
+                    LOGE("truncated audio frame\n");
+                    break;
+                }
+                pushDownlinkFrame(p, frameLen, now);
+                p += frameLen;
+            }
+        } else {
+            pushDownlinkFrame((const uint8_t*)data, len, now);
+        }
+        notifyDecodeTask();
     }
 }
 
-void BigMouthAI::onRequest(Rpc__Request* request) {
-    auto it = m_rpcHandlers.find(std::string("Rpc__")+request->protoname);
-    if (it != m_rpcHandlers.end()) {
-        it->second(request);
-    } else if (std::string(request->protoname) != "Ping") {
-        LOGE("Missing handler function for message: %s", request->protoname);
+void BigMouthAI::pushDownlinkFrame(const uint8_t* opus, size_t len, int64_t now) {
+    int64_t waitStart = 0;
+    while (true) {
+        {
+            // not held while waiting, the decode task needs it to make room
+            std::lock_guard<std::mutex> lock(m_codecMutex);
+            if (m_jitterBuffer.push(opus, len, now)) {
+                return;
+            }
+        }
+        // a reply longer than the ring is sent faster than it plays. holding the recv task
+        // stops reading the socket and tcp flow control slows the server down
+        int64_t t = esp_timer_get_time();
+        if (!waitStart) {
+            waitStart = t;
+            notifyDecodeTask();
+        }
+        if (getState() != Speaking || t - waitStart >= JITTER_FULL_WAIT_MS * 1000) {
+            // playback stopped or stalled, nothing is making room
+            m_jitterBuffer.dropFrame();
+            LOGW("jitter buffer full, frame dropped after %lldms\n", (t - waitStart) / 1000);
+            return;
+        }
+        vTaskDelay(pdMS_TO_TICKS(JITTER_FULL_POLL_MS));
     }
 }
 
@@ -99,8 +178,15 @@ void BigMouthAI::onJsonData(cJSON* root) {
         if (strcmp(state->valuestring, "start") == 0) {
             setState(Speaking);
         } else if (strcmp(state->valuestring, "stop") == 0) {
-            // 等待所有缓存语音数据播放完毕才能切换状态
-            xEventGroupSetBits(m_eventGroup, STOP_SPEAK_EVENT);
+            // 等待所有缓存语音数据播放完毕才能切换状态, audio task reports it with PLAYBACK_DONE_EVENT
+            m_ttsStopTime = esp_timer_get_time();
+            m_jitterBuffer.endOfStream();
+            // a short tail below target depth is played right away
+            notifyDecodeTask();
+        } else if (strcmp(state->valuestring, "sentence_end") == 0) {
+            // the pause before the next sentence is not an underrun
+            m_jitterBuffer.endOfSentence();
+            notifyDecodeTask();
         } else if (strcmp(state->valuestring, "sentence_start") == 0) {
             auto textItem = cJSON_GetObjectItem(root, "text");
             if (textItem != NULL) {
@@ -157,39 +243,48 @@ void BigMouthAI::onJsonData(cJSON* root) {
 void BigMouthAI::onServerHello(const cJSON* root) {
     printf("On server hello!!\n");
     uint16_t sampleRate = CUBICAT.speaker.getSampleRate();
+    // servers that don't negotiate send 60ms frames, one per message
+    uint16_t frameDuration = 60;
+    uint8_t framesPerPacket = 1;
     auto audio_params = cJSON_GetObjectItem(root, "audio_params");
     if (audio_params != NULL) {
         auto sample_rate = cJSON_GetObjectItem(audio_params, "sample_rate");
         auto channels = cJSON_GetObjectItem(audio_params, "channels");
         if (sample_rate != NULL) {
+            // opus decodes to any rate, no need to play more than configured
             sampleRate = sample_rate->valueint;
-            CUBICAT.speaker.setSampleRate(sampleRate);
-            printf("Server audio sample rate: %d channels: %d\n", sampleRate, channels->valueint);
-            CUBICAT.speaker.setVolume(1.0f);
-#ifdef CONFIG_AUDIO_PROCESSING
-            if (sampleRate != 16000) {
-                m_speakerResampler.Configure(sampleRate, 16000);
-            }
-#endif
+            if (sampleRate > CONFIG_AUDIO_DECODE_SAMPLE_RATE)
+                sampleRate = CONFIG_AUDIO_DECODE_SAMPLE_RATE;
+            printf("Server audio sample rate: %d channels: %d decode rate: %d\n", sample_rate->valueint,
+                channels ? channels->valueint : 1, sampleRate);
+        }
+        auto frame_duration = cJSON_GetObjectItem(audio_params, "frame_duration");
+        if (frame_duration != NULL && (frame_duration->valueint == 20 || frame_duration->valueint == 40 ||
+                frame_duration->valueint == 60)) {
+            frameDuration = frame_duration->valueint;
+        }
+        auto frames_per_packet = cJSON_GetObjectItem(audio_params, "frames_per_packet");
+        if (frames_per_packet != NULL && frames_per_packet->valueint >= 1) {
+            framesPerPacket = frames_per_packet->valueint;
         }
     }
-    if (!m_pOpusDecoder)
-        m_pOpusDecoder = std::make_unique<OpusDecoderWrapper>(sampleRate, 1, OPUS_FRAME_DURATION_MS);
-    if (!m_pOpusEncoder) {
-        m_pOpusEncoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-        m_pOpusEncoder->SetComplexity(3);
-        CUBICAT.mic.setSampleRate(16000);
-    }
-    m_opusFrameSize = 16000 / 1000 * 1 * OPUS_FRAME_DURATION_MS;
+    LOGI("audio frame: %dms frames per message: %d\n", frameDuration, framesPerPacket);
+    // read by this task when it splits downlink messages
+    m_nFramesPerPacket = framesPerPacket;
+    // a hello may come while audio is playing, codecs are swapped on the audio task
+    audioTask([this, sampleRate, frameDuration]() {
+        reconfigureAudio(sampleRate, frameDuration);
+    }, TASK_PRIORITY_HIGH);
     m_wakeWordDetect.OnWakeWordDetected([this](const std::string& wake_word) {
         m_sLastWakeWord = wake_word;
+        // user is talking, runs ahead of queued ui updates
         foregroundTask([this, &wake_word]() {
             if (m_eDeviceState == Speaking) {
                 abortSpeaking();
             }
             if (m_eDeviceState == Idle) {
                 setState(Connecting);
-                m_wakeWordDetect.EncodeWakeWordData();
+                m_wakeWordDetect.PrepareWakeWordOpus();
                 // Reopen audio channel if audio channel is closed
                 if (!m_pSocket->isConnected()) {
                     m_bAutoWakeOnReconnect = true;
@@ -198,7 +293,7 @@ void BigMouthAI::onServerHello(const cJSON* root) {
                 }
                 onWakeWord();
             }
-        });
+        }, TASK_PRIORITY_HIGH);
     });
     m_wakeWordDetect.StartDetection();
     CUBICAT.mic.start();
@@ -209,11 +304,12 @@ void BigMouthAI::onServerHello(const cJSON* root) {
     }
     // Audio processing 
 #ifdef CONFIG_AUDIO_PROCESSING
-    m_audioProcessor.OnOutput([this](std::vector<int16_t>&& data) {
-        audioTask([this, data = std::move(data)]() mutable {
-            m_pOpusEncoder->Encode(std::move(data), [this](std::vector<uint8_t>&& opus) {
-                sendAudio(opus.data(), opus.size());
-            });  
+    m_audioProcessor.OnOutput([this](PcmBlockRef&& block) {
+        // vad state belongs to this block, it changes before the audio task gets to it
+        bool speech = m_audioProcessor.IsSpeaking();
+        // block stays referenced until the audio task has encoded it
+        audioTask([this, speech, block = std::move(block)]() {
+            sendUplinkPCM(block, speech);
         });
     });
     m_audioProcessor.Stop();
@@ -227,9 +323,24 @@ void BigMouthAI::onServerHello(const cJSON* root) {
 
 void BigMouthAI::onWakeWord() {
     std::vector<uint8_t> opus;
-    // Encode and send the wake word data to the server
+    // Encode and send the wake word data to the server, batched like the uplink
+    std::vector<uint8_t> batch;
+    uint8_t framesPerPacket = m_nFramesPerPacket;
+    uint8_t frames = 0;
     while (m_wakeWordDetect.GetWakeWordOpus(opus)) {
-        sendAudio(opus.data(), opus.size());
+        if (framesPerPacket <= 1) {
+            sendAudio(opus.data(), opus.size());
+            continue;
+        }
+        appendAudioFrame(batch, opus.data(), opus.size());
+        if (++frames == framesPerPacket) {
+            sendAudio(batch.data(), batch.size());
+            batch.clear();
+            frames = 0;
+        }
+    }
+    if (frames) {
+        sendAudio(batch.data(), batch.size());
     }
     // Set the chat state to wake word detected
     sendWakeWord(m_sLastWakeWord);
@@ -237,117 +348,379 @@ void BigMouthAI::onWakeWord() {
     setState(Idle);
 }
 
-void BigMouthAI::loop() {
-    auto bits = xEventGroupWaitBits(m_eventGroup, FG_TASK_EVENT | STOP_SPEAK_EVENT, pdFALSE, pdFALSE, 0);
-    if (bits & FG_TASK_EVENT) {
-        std::lock_guard<std::recursive_mutex> lock(m_taskMutex);
-        while (!m_bgTasks.empty())
-        {
-            auto& func = m_bgTasks.front();
-            func();
-            m_bgTasks.pop_front();
+void BigMouthAI::reconfigureAudio(uint16_t sampleRate, uint16_t frameDuration) {
+    // frames batched for the previous connection
+    m_uplinkBatch.clear();
+    m_nBatchedFrames = 0;
+    bool decoderChanged = !m_pOpusDecoder || sampleRate != m_nDecodeRate || frameDuration != m_nFrameDuration;
+    bool encoderChanged = !m_pOpusEncoder || frameDuration != m_nFrameDuration;
+    if (decoderChanged || frameDuration != m_nFrameDuration) {
+        // the decode task and the jitter buffer producer stay out until the swap is done,
+        // playback of the audio task is this task
+        std::lock_guard<std::mutex> lock(m_codecMutex);
+        m_jitterBuffer.setFrameDuration(frameDuration);
+        if (decoderChanged) {
+            m_pOpusDecoder = std::make_unique<OpusDecoderWrapper>(sampleRate, 1, frameDuration);
+            // one slot per decoded frame, tag is the packet arrival time
+            m_pPcmRing = std::make_unique<PacketRing>(DECODE_AHEAD_FRAMES, sampleRate / 1000 * frameDuration * sizeof(int16_t));
+            m_nDecodeRate = sampleRate;
+            CUBICAT.speaker.setSampleRate(sampleRate);
+            CUBICAT.speaker.setVolume(1.0f);
+#ifdef CONFIG_AUDIO_PROCESSING
+            if (sampleRate != 16000) {
+                m_speakerResampler.Configure(sampleRate, 16000);
+            }
+#endif
         }
-        xEventGroupClearBits(m_eventGroup, FG_TASK_EVENT);
     }
-    if (bits & STOP_SPEAK_EVENT) {
+    if (encoderChanged) {
+        // encoder is only used by this task
+        auto& rate = m_rateController.current();
+        m_pOpusEncoder = std::make_unique<UplinkEncoder>(16000, 1, frameDuration, rate.bitrate);
+        m_pOpusEncoder->setComplexity(rate.complexity);
+        m_pOpusEncoder->setFec(rate.fecLoss);
+        CUBICAT.mic.setSampleRate(16000);
+    }
+    m_nFrameDuration = frameDuration;
+    m_opusFrameSize = 16000 / 1000 * 1 * frameDuration;
+}
+
+void BigMouthAI::loop() {
+    // no polling, the switch to listening follows the end of playback right away
+    auto bits = xEventGroupWaitBits(m_eventGroup, PLAYBACK_DONE_EVENT, pdTRUE, pdFALSE, portMAX_DELAY);
+    if (bits & PLAYBACK_DONE_EVENT) {
         if (m_eDeviceState == Speaking) {
-            if (m_opusBufferQueue.empty()) {
-                setState(Listening);
-                xEventGroupClearBits(m_eventGroup, STOP_SPEAK_EVENT);
+            JitterBufferStats stats;
+            {
+                std::lock_guard<std::mutex> lock(m_codecMutex);
+                stats = m_jitterBuffer.getStats();
             }
-        } else {
-            xEventGroupClearBits(m_eventGroup, STOP_SPEAK_EVENT);
+            LOGI("jitter buffer played: %u concealed: %u underruns: %u overruns: %u target: %d jitter: %uus\n",
+                stats.played, stats.concealed, stats.underruns, stats.overruns, stats.targetDepth, stats.jitter);
+            int64_t now = esp_timer_get_time();
+            LOGI("playback drained %lldms after tts stop, listening %lldms after the last sample\n",
+                (m_speakerDrainTime - m_ttsStopTime) / 1000, (now - m_speakerDrainTime) / 1000);
+            setState(Listening);
         }
     }
-    auto now = timeNow();
-    if (m_pSocket && now - m_lastPingTime >= 5) {
-        m_pSocket->ping();
-        m_lastPingTime = now;
+}
+
+bool BigMouthAI::runForegroundTasks() {
+    bool ran = false;
+    auto bits = xEventGroupGetBits(m_eventGroup);
+    if (bits & FG_TASK_EVENT) {
+        // cleared first, a task posted while draining sets it again
+        xEventGroupClearBits(m_eventGroup, FG_TASK_EVENT);
+        if (m_foregroundTasks.drain(FG_TASK_BUDGET_US)) {
+            // keeps the ui frame rate, the rest runs next frame
+            xEventGroupSetBits(m_eventGroup, FG_TASK_EVENT);
+        }
+        ran = true;
+    }
+    if (m_pMcpServer->loop()) {
+        ran = true;
     }
-    m_pMcpServer->loop();
+    return ran;
 }
 
-void BigMouthAI::audioLoop() {
-    vTaskDelay(10 / portTICK_PERIOD_MS);
-    auto bits = xEventGroupWaitBits(m_eventGroup, AUDIO_TASK_EVENT, pdTRUE, pdFALSE, 0);
-    if (bits & AUDIO_TASK_EVENT) {
-        std::lock_guard<std::recursive_mutex> lock(m_audioTaskMutex);
-        while (!m_audioTasks.empty())
+void BigMouthAI::setForegroundTaskHandle(TaskHandle_t handle) {
+    m_foregroundTaskHandle = handle;
+    m_pMcpServer->setForegroundTaskHandle(handle);
+}
+
+TickType_t BigMouthAI::audioWaitTicks() {
+    // speaker keeps pulling frames while it has them, playRaw blocking on a full i2s buffer paces it
+    if (getState() == Speaking && m_bPlaying) {
+        return 0;
+    }
+    // last sample is still in the speaker dma, wake up when it has been played
+    if (getState() == Speaking && m_nPlaybackDoneStream != m_nDrainedStream) {
+        int64_t remain = m_speakerDrainTime - esp_timer_get_time();
+        return remain > 0 ? pdMS_TO_TICKS(remain / 1000) + 1 : 0;
+    }
+    bool micConsumed = m_frontEnd.IsRunning() || getState() == Listening;
+    return micConsumed ? pdMS_TO_TICKS(AUDIO_MIC_PERIOD_MS) : portMAX_DELAY;
+}
+
+void BigMouthAI::notifyDecodeTask() {
+    if (m_decodeTaskHandle) {
+        xTaskNotify(m_decodeTaskHandle, 1, eSetBits);
+    }
+}
+
+void BigMouthAI::decodeLoop() {
+    xTaskNotifyWait(0, UINT32_MAX, nullptr, portMAX_DELAY);
+    // decoder, pcm ring and jitter ring are swapped under this lock
+    std::lock_guard<std::mutex> lock(m_codecMutex);
+    if (getState() != Speaking || !m_pPcmRing) {
+        return;
+    }
+    uint32_t stream = m_nDecodeStream.load();
+    if (stream != m_nDecoderStream) {
+        // pcm of the previous stream is never played
+        m_nDecoderStream = stream;
+        m_pPcmRing->discardAll();
+        m_pOpusDecoder->ResetState();
+    }
+    if (m_nDrainedStream == stream) {
+        return;
+    }
+    while (m_pPcmRing->size() < m_pPcmRing->getSlotCount()) {
+        // a late packet is only concealed once playback is about to run dry
+        if (m_jitterBuffer.empty() && m_pPcmRing->size() > DECODE_LOW_WATER_FRAMES) {
+            break;
+        }
+        std::vector<uint8_t> opus;
+        uint32_t arrival = 0;
+        auto result = m_jitterBuffer.pop(opus, &arrival);
+        if (result == JITTER_WAIT) {
+            break;
+        }
+        // decode opus, an empty packet from JITTER_CONCEAL makes opus run PLC for the late frame
+        // decode buffer is kept across frames so its capacity is reused
+        int64_t decodeStart = esp_timer_get_time();
+        bool decoded = m_pOpusDecoder->Decode(std::move(opus), m_playPCM);
         {
-            auto& func = m_audioTasks.front();
-            func();
-            m_audioTasks.pop_front();
+            std::lock_guard<std::mutex> lock(m_statsMutex);
+            m_decodeTime.add(esp_timer_get_time() - decodeStart);
+        }
+        if (!decoded) {
+            continue;
+        }
+        m_pPcmRing->push((const uint8_t*)m_playPCM.data(), m_playPCM.size() * sizeof(int16_t),
+            result == JITTER_FRAME ? arrival : 0);
+        notifyAudioTask(AUDIO_NOTIFY_PACKET);
+    }
+    // every packet of the stream is in the ring, what the audio task plays next is the tail
+    if (m_jitterBuffer.drained()) {
+        m_nDrainedStream = stream;
+        notifyAudioTask(AUDIO_NOTIFY_PACKET);
+    }
+}
+
+void BigMouthAI::notifyAudioTask(uint32_t bits) {
+    if (m_audioTaskHandle) {
+        xTaskNotify(m_audioTaskHandle, bits, eSetBits);
+    }
+}
+
+void BigMouthAI::audioLoop() {
+    uint32_t bits = 0;
+    xTaskNotifyWait(0, UINT32_MAX, &bits, audioWaitTicks());
+    if (bits & AUDIO_NOTIFY_TASK) {
+        if (m_audioTasks.drain(AUDIO_TASK_BUDGET_US)) {
+            // playback and mic go first, the rest runs on the next wake up
+            notifyAudioTask(AUDIO_NOTIFY_TASK);
         }
     }
+    updateRateControl();
     std::vector<int16_t> micPCM = CUBICAT.mic.popAudioBuffer(0);
-    // Wake word detection data feed
+    int64_t micTime = 0;
+    if (micPCM.size()) {
+        // oldest sample of the chunk was captured at least one chunk duration ago
+        micTime = esp_timer_get_time() - (int64_t)micPCM.size() * 1000000 / CUBICAT.mic.getSampleRate();
+    }
+    // front end data feed, serves wake word detection and aec uplink alike
     if (micPCM.size()) {
-        if (m_wakeWordDetect.IsDetectionRunning()) {
-            m_wakeWordDetect.Feed(micPCM);
+        m_nMicBlocks++;
+        if (m_frontEnd.IsRunning()) {
+            feedFrontEnd(micPCM, micTime);
         }
     }
     if (getState() == Speaking) {
-        if (m_opusBufferQueue.empty()) {
+        size_t len = 0;
+        uint32_t arrival = 0;
+        const uint8_t* pcm = m_pPcmRing ? m_pPcmRing->front(&len, &arrival) : nullptr;
+        if (!pcm) {
+            // nothing decoded, sleep until the decoder pushes a frame.
+            // packets waiting while the ring ran dry means the decoder fell behind
+            if (m_bPlaying && !m_jitterBuffer.empty()) {
+                m_nPcmUnderruns++;
+            }
+            m_bPlaying = false;
+            uint32_t drained = m_nDrainedStream;
+            // tail is written, report once the speaker has played it out
+            if (drained == m_nDecodeStream && drained != m_nPlaybackDoneStream
+                && esp_timer_get_time() >= m_speakerDrainTime) {
+                m_nPlaybackDoneStream = drained;
+                xEventGroupSetBits(m_eventGroup, PLAYBACK_DONE_EVENT);
+            }
             return;
         }
-        std::unique_lock<std::recursive_mutex> lock(m_opusMutex);
-        auto opus = std::move(m_opusBufferQueue.front());
-        m_opusBufferQueue.pop_front();
-        lock.unlock();
-        // decode opus
-        std::vector<int16_t> playPCM;
-        if (!m_pOpusDecoder->Decode(std::move(opus), playPCM)) {
-            return;
+        m_bPlaying = true;
+        size_t ahead = m_pPcmRing->size();
+        m_pcmOccupancy.add(ahead);
+        // low water, decoder refills the ring while the speaker plays this frame
+        if (ahead - 1 <= DECODE_LOW_WATER_FRAMES) {
+            notifyDecodeTask();
         }
+        const int16_t* playPCM = (const int16_t*)pcm;
+        size_t playSamples = len / sizeof(int16_t);
 #ifdef CONFIG_AUDIO_PROCESSING
         // Input audio aec process
-        std::vector<int16_t>* resampledRef = &playPCM;
-        std::vector<int16_t> resampleBuff;
-        if (m_audioProcessor.IsRunning()) {
-            // combine pcm with output pcm which is work as reference
-            std::vector<int16_t> pcmWithRef;
-            // resample speaker pcm data if speaker sample rate is not 16k
-            if (CUBICAT.speaker.getSampleRate() != CUBICAT.mic.getSampleRate()) {
-                resampleBuff.resize(m_speakerResampler.GetOutputSamples(playPCM.size()));
-                m_speakerResampler.Process(playPCM.data(), playPCM.size(), resampleBuff.data());
-                resampledRef = &resampleBuff;
-            }
-            if (m_loopbackBuffer.len >= micPCM.size() * 2) {
-                pcmWithRef.resize(micPCM.size() * 2);
-                int16_t* loopback = (int16_t*)m_loopbackBuffer.data + (m_loopbackBuffer.len/2 - micPCM.size());
-                for (int i = 0; i < micPCM.size(); i++) {
-                    pcmWithRef[i*2] = micPCM[i];
-                    pcmWithRef[i*2 + 1] = *(loopback++);
-                }
-                m_audioProcessor.Feed(pcmWithRef);   
-            }
+        const int16_t* refPCM = playPCM;
+        size_t refSamples = playSamples;
+        PcmBlockRef resampled;
+        // resample speaker pcm data if speaker sample rate is not 16k
+        if (m_frontEnd.IsRunning() && CUBICAT.speaker.getSampleRate() != CUBICAT.mic.getSampleRate()) {
+            resampled = PcmBlockPool::Shared().Acquire(m_speakerResampler.GetOutputSamples(playSamples));
+            m_speakerResampler.Process(playPCM, playSamples, resampled.data());
+            refPCM = resampled.data();
+            refSamples = resampled.size();
+        }
+        if (m_frontEnd.IsRunning()) {
+            // stamped at hand over, the ring queues it behind what the speaker still plays
+            m_aecReference.Write(refPCM, refSamples, esp_timer_get_time());
         }
 #endif
-        CUBICAT.speaker.playRaw(playPCM.data(), playPCM.size(), 1);
+        // speaker queue is modelled like the aec reference, the block plays right after what is still queued
+        int64_t writeTime = esp_timer_get_time();
+        if (m_speakerDrainTime < writeTime) {
+            m_speakerDrainTime = writeTime;
+        }
+        m_speakerDrainTime += (int64_t)playSamples * 1000000 / CUBICAT.speaker.getSampleRate();
+        CUBICAT.speaker.playRaw(playPCM, playSamples, 1);
+        // concealed frames have no arrival
+        if (arrival) {
+            m_packetToSpeaker.add((uint32_t)esp_timer_get_time() - arrival);
+        }
+        m_pPcmRing->pop();
+    } else if (getState() == Listening) {
 #ifdef CONFIG_AUDIO_PROCESSING
-        m_loopbackBuffer.append((uint8_t*)resampledRef->data(), resampledRef->size() * sizeof(int16_t));
+        // aec processed audio goes up through the processor output instead
+        if (m_audioProcessor.IsRunning()) {
+            return;
+        }
 #endif
-    } else if (getState() == Listening) {
-        if (micPCM.size()) {
-            m_pOpusEncoder->Encode(std::move(micPCM),
-             [this](std::vector<uint8_t>&& opus) {
-                sendAudio(opus.data(), opus.size());
+        // encoder comes with the server hello
+        if (micPCM.size() && m_pOpusEncoder) {
+            int64_t encodeStart = esp_timer_get_time();
+            m_pOpusEncoder->encode(micPCM.data(), micPCM.size(),
+             [this, micTime](const uint8_t* opus, size_t len) {
+                sendAudioFrame(opus, len);
+                m_micToUplink.add(esp_timer_get_time() - micTime);
             });
+            m_nAudioBusyUs += esp_timer_get_time() - encodeStart;
+        }
+    }
+}
+
+void BigMouthAI::updateRateControl() {
+    int64_t now = esp_timer_get_time();
+    if (!m_pOpusEncoder || !m_pSocket || now - m_lastRateControlTime < RATE_CONTROL_INTERVAL_MS * 1000) {
+        return;
+    }
+    int64_t elapsed = now - m_lastRateControlTime;
+    bool first = m_lastRateControlTime == 0;
+    m_lastRateControlTime = now;
+    TxStats tx = m_pSocket->getTxStats();
+    TxStats last = m_lastTxStats;
+    uint32_t busy = m_nAudioBusyUs;
+    m_lastTxStats = tx;
+    m_nAudioBusyUs = 0;
+    if (first) {
+        return;
+    }
+    const TxLaneStats& lane = tx.lanes[TX_LANE_AUDIO];
+    const TxLaneStats& lastLane = last.lanes[TX_LANE_AUDIO];
+    RateSample sample;
+    sample.queueDepth = lane.depth;
+    sample.sent = lane.sent - lastLane.sent;
+    sample.dropped = lane.droppedFull + lane.droppedStale - lastLane.droppedFull - lastLane.droppedStale;
+    uint32_t samples = tx.latencySamples - last.latencySamples;
+    sample.sendLatencyUs = samples ? (tx.totalLatency - last.totalLatency) / samples : 0;
+    sample.rttUs = m_pSocket->getRtt();
+    sample.cpuLoad = busy * 100 / elapsed;
+    auto previous = m_rateController.current();
+    auto& rate = m_rateController.update(sample);
+    if (rate.bitrate != previous.bitrate)
+        m_pOpusEncoder->setBitrate(rate.bitrate);
+    if (rate.complexity != previous.complexity)
+        m_pOpusEncoder->setComplexity(rate.complexity);
+    if (rate.fecLoss != previous.fecLoss)
+        m_pOpusEncoder->setFec(rate.fecLoss);
+    if (m_rateController.isCongested() || rate.bitrate != previous.bitrate) {
+        LOGI("uplink rate %d complexity %d fec %d%%, depth: %u dropped: %u latency: %uus rtt: %uus cpu: %u%%\n",
+            rate.bitrate, rate.complexity, rate.fecLoss, sample.queueDepth, sample.dropped,
+            sample.sendLatencyUs, sample.rttUs, sample.cpuLoad);
+    }
+}
+
+void BigMouthAI::feedFrontEnd(const std::vector<int16_t>& micPCM, int64_t micTime) {
+    if (!m_frontEnd.HasReference()) {
+        m_frontEnd.Feed(micPCM.data(), micPCM.size());
+        return;
+    }
+#ifdef CONFIG_AUDIO_PROCESSING
+    // combine pcm with the speaker pcm played when it was captured, silence while nothing is played
+    PcmBlockRef pcmWithRef = PcmBlockPool::Shared().Acquire(micPCM.size() * 2);
+    m_aecReference.Interleave(micPCM.data(), micPCM.size(), micTime, pcmWithRef.data());
+    m_frontEnd.Feed(pcmWithRef.data(), pcmWithRef.size());
+#endif
+}
+
+void BigMouthAI::sendUplinkPCM(const PcmBlockRef& block, bool speech) {
+    int64_t now = esp_timer_get_time();
+    auto event = m_endpointer.Process(speech, block.size() * 1000 / 16000, now);
+    if (event == ENDPOINT_SPEECH_START) {
+        if (m_bListenStopped) {
+            sendStartListening(m_eListeningMode);
+        }
+        // frames from just before the vad noticed the speech
+        for (size_t i = 0; i < m_nPrerollCount; i++) {
+            auto& opus = m_uplinkPreroll[(m_nPrerollHead + i) % UPLINK_PREROLL_FRAMES];
+            sendAudioFrame(opus.data(), opus.size());
+            m_nUplinkSent++;
         }
+        m_nPrerollCount = 0;
+    }
+    // created by the first server hello
+    if (!m_pOpusEncoder) {
+        return;
+    }
+    // encoder keeps running through silence so the utterance starts with warm state
+    m_pOpusEncoder->encode(block.data(), block.size(), [this](const uint8_t* opus, size_t len) {
+        if (m_endpointer.InUtterance()) {
+            sendAudioFrame(opus, len);
+            m_nUplinkSent++;
+            return;
+        }
+        if (m_nPrerollCount == UPLINK_PREROLL_FRAMES) {
+            m_nPrerollHead = (m_nPrerollHead + 1) % UPLINK_PREROLL_FRAMES;
+            m_nPrerollCount--;
+            m_nUplinkSuppressed++;
+        }
+        m_uplinkPreroll[(m_nPrerollHead + m_nPrerollCount++) % UPLINK_PREROLL_FRAMES].assign(opus, opus + len);
+    });
+    m_nAudioBusyUs += esp_timer_get_time() - now;
+    if (event == ENDPOINT_SPEECH_END) {
+        const Utterance& utterance = m_endpointer.GetLastUtterance();
+        LOGI("utterance %u: %lldms long, ended %lldms ago\n", m_endpointer.GetUtteranceCount(),
+            (utterance.end_us - utterance.start_us) / 1000, (now - utterance.end_us) / 1000);
+        m_utteranceEndTime = utterance.end_us;
+        // last partial batch goes out before the stop
+        flushAudioFrames();
+        // server needn't wait for its own vad to end the turn
+        sendStopListening();
     }
 }
 
+void BigMouthAI::resetUplink() {
+    m_endpointer.Reset();
+    m_nPrerollCount = 0;
+}
 
-void BigMouthAI::foregroundTask(std::function<void()> callback) {
-    std::lock_guard<std::recursive_mutex> lock(m_taskMutex);
-    m_bgTasks.push_back(callback);
+void BigMouthAI::foregroundTask(TaskFunction callback, TaskPriority priority) {
+    m_foregroundTasks.post(std::move(callback), priority);
     xEventGroupSetBits(m_eventGroup, FG_TASK_EVENT);
+    if (m_foregroundTaskHandle) {
+        xTaskNotifyGive(m_foregroundTaskHandle);
+    }
 }
 
-void BigMouthAI::audioTask(std::function<void()> callback) {
-    std::lock_guard<std::recursive_mutex> lock(m_audioTaskMutex);
-    m_audioTasks.push_back(callback);
-    xEventGroupSetBits(m_eventGroup, AUDIO_TASK_EVENT);
+void BigMouthAI::audioTask(TaskFunction callback, TaskPriority priority) {
+    m_audioTasks.post(std::move(callback), priority);
+    notifyAudioTask(AUDIO_NOTIFY_TASK);
 }
 
 void BigMouthAI::abortSpeaking() {
@@ -359,14 +732,14 @@ void BigMouthAI::abortSpeaking() {
     message += "}";
     Rpc__Msg msg = RPC__MSG__INIT;
     msg.text = (char*)message.c_str();
-    m_pSocket->send("jsonMessage", &msg);
+    m_pSocket->send("jsonMessage", &msg, TX_LANE_AUDIO);
 }
 void BigMouthAI::sendWakeWord(const std::string& wakeWord) {
     std::string json = "{\"session_id\":\"" + session_id + 
     "\",\"type\":\"listen\",\"state\":\"detect\",\"text\":\"" + wakeWord + "\"}";
     Rpc__Msg msg = RPC__MSG__INIT;
     msg.text = (char*)json.c_str();
-    m_pSocket->send("jsonMessage", &msg);
+    m_pSocket->send("jsonMessage", &msg, TX_LANE_AUDIO);
 }
 
 void BigMouthAI::sendAudio(const uint8_t* data, size_t len) {
@@ -376,7 +749,47 @@ void BigMouthAI::sendAudio(const uint8_t* data, size_t len) {
     m_pSocket->send("audioMessage", &msg);
 }
 
+void BigMouthAI::sendHello() {
+    // preferences only, the server hello has the final say
+    std::string message = "{\"type\":\"hello\",\"audio_params\":{\"format\":\"opus\",\"sample_rate\":16000,\"channels\":1";
+    message += ",\"frame_duration\":" + std::to_string(CONFIG_AUDIO_FRAME_DURATION_MS);
+    message += ",\"decode_sample_rate\":" + std::to_string(CONFIG_AUDIO_DECODE_SAMPLE_RATE);
+    message += ",\"frames_per_packet\":" + std::to_string(CONFIG_AUDIO_FRAMES_PER_PACKET);
+    message += "}}";
+    Rpc__Msg msg = RPC__MSG__INIT;
+    msg.text = (char*)message.c_str();
+    m_pSocket->send("jsonMessage", &msg);
+}
+
+void BigMouthAI::appendAudioFrame(std::vector<uint8_t>& batch, const uint8_t* opus, size_t len) {
+    batch.push_back(len >> 8);
+    batch.push_back(len & 0xff);
+    batch.insert(batch.end(), opus, opus + len);
+}
+
+void BigMouthAI::sendAudioFrame(const uint8_t* opus, size_t len) {
+    if (m_nFramesPerPacket <= 1) {
+        sendAudio(opus, len);
+        return;
+    }
+    appendAudioFrame(m_uplinkBatch, opus, len);
+    if (++m_nBatchedFrames >= m_nFramesPerPacket) {
+        flushAudioFrames();
+    }
+}
+
+void BigMouthAI::flushAudioFrames() {
+    if (m_nBatchedFrames) {
+        sendAudio(m_uplinkBatch.data(), m_uplinkBatch.size());
+        // clear keeps the capacity
+        m_uplinkBatch.clear();
+        m_nBatchedFrames = 0;
+    }
+}
+
 void BigMouthAI::sendStartListening(ListeningMode mode) {
+    m_eListeningMode = mode;
+    m_bListenStopped = false;
     std::string message = "{\"session_id\":\"" + session_id + "\"";
     message += ",\"type\":\"listen\",\"state\":\"start\"";
     if (mode == Realtime) {
@@ -389,7 +802,15 @@ void BigMouthAI::sendStartListening(ListeningMode mode) {
     message += "}";
     Rpc__Msg msg = RPC__MSG__INIT;
     msg.text = (char*)message.c_str();
-    m_pSocket->send("jsonMessage", &msg);
+    m_pSocket->send("jsonMessage", &msg, TX_LANE_AUDIO);
+}
+
+void BigMouthAI::sendStopListening() {
+    m_bListenStopped = true;
+    std::string message = "{\"session_id\":\"" + session_id + "\",\"type\":\"listen\",\"state\":\"stop\"}";
+    Rpc__Msg msg = RPC__MSG__INIT;
+    msg.text = (char*)message.c_str();
+    m_pSocket->send("jsonMessage", &msg, TX_LANE_AUDIO);
 }
 
 std::string GenerateUuid() {
@@ -436,6 +857,16 @@ void BigMouthAI::setState(DeviceState state) {
 
 void BigMouthAI::onStateChange() {
     printf("state change: %s\n", getCurrentStateName().c_str());
+    // stats belong to the audio task, report them there
+    audioTask([this]() {
+        logAudioLatency();
+    }, TASK_PRIORITY_LOW);
+    // audio task recomputes how long it may sleep
+    notifyAudioTask(AUDIO_NOTIFY_STATE);
+    // a partial batch of the previous state isn't followed by more frames anytime soon
+    audioTask([this]() {
+        flushAudioFrames();
+    });
     if (getState() == Idle) {
         CUBICAT.speaker.setEnable(false);
         m_wakeWordDetect.StartDetection();
@@ -445,24 +876,33 @@ void BigMouthAI::onStateChange() {
     } else if (getState() == Connecting) {
 
     } else if (getState() == Speaking) {
-        LOCK_OPUS_BUFFER
-        m_opusBufferQueue.clear();
+        {
+            std::lock_guard<std::mutex> lock(m_codecMutex);
+            m_jitterBuffer.start();
+        }
+        // decoder drops the pcm and state of the previous stream
+        m_nDecodeStream++;
+        notifyDecodeTask();
         CUBICAT.speaker.setEnable(true);
         m_wakeWordDetect.StopDetection();
-        m_pOpusDecoder->ResetState();
     } else if (getState() == Listening) {
         CUBICAT.speaker.setEnable(false);
         CUBICAT.mic.start();
 #ifdef CONFIG_AUDIO_PROCESSING
         if (!m_audioProcessor.IsRunning()) {
             sendStartListening(Realtime);
+            audioTask([this](){
+                resetUplink();
+            });
             m_audioProcessor.Start();
         }
 #else
         sendStartListening(AutoStop);
 #endif
         audioTask([this](){
-            m_pOpusEncoder->ResetState();
+            if (m_pOpusEncoder) {
+                m_pOpusEncoder->resetState();
+            }
         });
         m_wakeWordDetect.StopDetection();
     }
@@ -474,6 +914,71 @@ void BigMouthAI::onStateChange() {
     });
 }
 
+void BigMouthAI::logAudioLatency() {
+    // allocation rates since last log
+    int64_t now = esp_timer_get_time();
+    float seconds = (now - m_lastAllocLogTime) / 1000000.0f;
+    auto pool = PcmBlockPool::Shared().GetStats();
+    if (m_lastAllocLogTime && seconds > 0) {
+        LOGI("pcm blocks/s pooled: %.1f heap: %.1f mic driver: %.1f, in use: %d peak: %d\n",
+            (pool.acquired - m_lastPoolStats.acquired) / seconds,
+            (pool.heap_allocs - m_lastPoolStats.heap_allocs) / seconds,
+            m_nMicBlocks / seconds, pool.in_use, pool.peak);
+    }
+    m_lastPoolStats = pool;
+    m_lastAllocLogTime = now;
+    m_nMicBlocks = 0;
+    if (m_micToUplink.count) {
+        LOGI("mic to uplink latency avg: %uus max: %uus frames: %u\n",
+            m_micToUplink.avg(), m_micToUplink.max, m_micToUplink.count);
+        m_micToUplink.reset();
+    }
+    if (m_packetToSpeaker.count) {
+        LOGI("packet to speaker latency avg: %uus max: %uus frames: %u\n",
+            m_packetToSpeaker.avg(), m_packetToSpeaker.max, m_packetToSpeaker.count);
+        m_packetToSpeaker.reset();
+    }
+    LatencyStat decodeTime;
+    LatencyStat speechEndToTts;
+    {
+        std::lock_guard<std::mutex> lock(m_statsMutex);
+        decodeTime = m_decodeTime;
+        speechEndToTts = m_speechEndToTts;
+        m_decodeTime.reset();
+        m_speechEndToTts.reset();
+    }
+    if (decodeTime.count) {
+        // frames ahead in hundredths
+        uint32_t ahead = m_pcmOccupancy.count ? m_pcmOccupancy.total * 100 / m_pcmOccupancy.count : 0;
+        LOGI("decode time avg: %uus max: %uus frames: %u, frames ahead avg: %u.%02u underruns: %u\n",
+            decodeTime.avg(), decodeTime.max, decodeTime.count, ahead / 100, ahead % 100, m_nPcmUnderruns);
+        m_pcmOccupancy.reset();
+        m_nPcmUnderruns = 0;
+    }
+    if (m_nUplinkSent || m_nUplinkSuppressed) {
+        LOGI("uplink frames sent: %u suppressed: %u utterances: %u\n",
+            m_nUplinkSent, m_nUplinkSuppressed, m_endpointer.GetUtteranceCount());
+        m_nUplinkSent = 0;
+        m_nUplinkSuppressed = 0;
+    }
+    if (speechEndToTts.count) {
+        LOGI("speech end to tts latency avg: %uus max: %uus turns: %u\n",
+            speechEndToTts.avg(), speechEndToTts.max, speechEndToTts.count);
+    }
+#ifdef CONFIG_AUDIO_PROCESSING
+    if (m_aecReference.GetEstimateCount()) {
+        LOGI("aec reference delay: %dms correlation: %d%% estimates: %u\n", m_aecReference.GetDelayMs(),
+            m_aecReference.GetLastCorrelation(), m_aecReference.GetEstimateCount());
+    }
+#endif
+    m_foregroundTasks.logStats();
+    m_audioTasks.logStats();
+    m_pMcpServer->logTaskStats();
+    if (m_pSocket) {
+        m_pSocket->logStats();
+    }
+}
+
 std::string BigMouthAI::getCurrentStateName() {
     switch (m_eDeviceState) {
         case DeviceState::Idle:
@@ -3,21 +3,35 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <vector>
-#include <list>
 #include <stdint.h>
 #include <freertos/semphr.h>
 #include "wake_detect/wake_word_detect_afe.h"
 #include "opus_decoder.h"
-#include "opus_encoder.h"
 #include "opus_resampler.h"
-#include "devices/audio_buffer.h"
 #include <functional>
+#include <array>
+#include <mutex>
+#include "audio_processing/audio_front_end.h"
 #include "audio_processing/audio_processor.h"
+#include "audio_processing/aec_reference.h"
+#include "audio_processing/endpointer.h"
+#include "jitter_buffer.h"
+#include "uplink_encoder.h"
+#include "rate_controller.h"
 #include "../proto_socket.h"
+#include "../task_executor.h"
+#include "../timer_wheel.h"
 #include "../mcp_server/mcp_server.h"
 
-// AEC not working right now
-// #define CONFIG_AUDIO_PROCESSING
+// silence after speech before the utterance is over and listening is stopped
+#define UPLINK_VAD_HANGOVER_MS 600
+// shorter speech is a click, not an utterance
+#define UPLINK_MIN_SPEECH_MS 120
+// opus frames held back while silent, sent ahead of the utterance to cover vad onset lag
+#define UPLINK_PREROLL_FRAMES 5
+
+// uplink encoder settings are revised this often
+#define RATE_CONTROL_INTERVAL_MS 1000
 
 #define DECLARE_RPC_HANDLER(proto) \
     void on##proto(Rpc__Request* req);
@@ -41,6 +55,21 @@ enum DeviceState : uint8_t {
     Upgrading
 };
 
+// accumulated latency of an audio stage, in us
+struct LatencyStat {
+    uint32_t    count = 0;
+    uint64_t    total = 0;
+    uint32_t    max = 0;
+    void add(uint32_t us) {
+        count++;
+        total += us;
+        if (us > max)
+            max = us;
+    }
+    uint32_t avg() const { return count ? total / count : 0; }
+    void reset() { *this = LatencyStat(); }
+};
+
 using TTSCallback = std::function<void (const std::string& text)>;
 using LLMCallback = std::function<void (Emotion emo)>;
 using StateCallback = std::function<void (DeviceState state)>;
@@ -60,9 +89,15 @@ public:
     void onBeginConnect() override;
     void onConnected(Socket* socket) override;
     void onDisconnected() override;
-    void onRequest(Rpc__Request*) override;
+    void onRequest(Rpc__Request* request, uint16_t msgId) override;
 
+    // blocks until the next state event, runs on the main task
     void loop();
+    // ui work posted by the ai and the mcp tools, runs on the render task once per frame.
+    // true if anything ran
+    bool runForegroundTasks();
+    // notified when ui work is posted, ends an idle frame wait early
+    void setForegroundTaskHandle(TaskHandle_t handle);
     std::string getUUID();
     DeviceState getState() { return m_eDeviceState; }
     void setTTSCallback(TTSCallback ttsCallback) {m_ttsCallback = ttsCallback;}
@@ -72,22 +107,48 @@ public:
 
     // Internal use only
     void audioLoop();
+    void decodeLoop();
 private:
-    void registerRpcHandler();
+    using RpcHandler = void (BigMouthAI::*)(Rpc__Request*);
+    using RpcHandlerTable = std::array<RpcHandler, RPC_MSG_ID_COUNT>;
+    static constexpr RpcHandlerTable makeRpcHandlerTable();
     void onServerHello(const cJSON* root);
+    // audio task, swaps codecs and rings for the negotiated audio parameters
+    void reconfigureAudio(uint16_t sampleRate, uint16_t frameDuration);
     void setState(DeviceState state);
     void onStateChange();
     void onWakeWord();
     void onBinaryData(const char* data, unsigned int len);
+    // recv task, waits for playback while the jitter buffer is full
+    void pushDownlinkFrame(const uint8_t* opus, size_t len, int64_t now);
     void onJsonData(cJSON* root);
     // Protocal begin
     void abortSpeaking();
     void sendWakeWord(const std::string& wakeWord);
     void sendAudio(const uint8_t* data, size_t len);
+    // audio task only, frames are packed per negotiated frames per message
+    void sendAudioFrame(const uint8_t* opus, size_t len);
+    void flushAudioFrames();
+    static void appendAudioFrame(std::vector<uint8_t>& batch, const uint8_t* opus, size_t len);
+    // client half of the audio parameter negotiation
+    void sendHello();
     void sendStartListening(ListeningMode mode);
+    void sendStopListening();
     // Protocal end
-    void foregroundTask(std::function<void()> callback);
-    void audioTask(std::function<void()> callback);
+    void foregroundTask(TaskFunction callback, TaskPriority priority = TASK_PRIORITY_NORMAL);
+    void audioTask(TaskFunction callback, TaskPriority priority = TASK_PRIORITY_NORMAL);
+    void notifyAudioTask(uint32_t bits);
+    void notifyDecodeTask();
+    TickType_t audioWaitTicks();
+    // interleaves the speaker reference when the front end runs aec
+    void feedFrontEnd(const std::vector<int16_t>& micPCM, int64_t micTime);
+    // endpointing and silence gating of processed mic pcm, audio task only
+    void sendUplinkPCM(const PcmBlockRef& block, bool speech);
+    void resetUplink();
+    // adapts uplink bitrate, complexity and fec to the link and the audio task load
+    void updateRateControl();
+    // latency and allocation rates, logged and reset on every state change. audio task only
+    void logAudioLatency();
     void reboot();
 
     std::string getCurrentStateName();
@@ -99,34 +160,93 @@ private:
     DECLARE_RPC_HANDLER(Rpc__BytesMsg) // 服务器下发的语音数据
 
     ProtoSocket*                        m_pSocket = nullptr;
-    std::list<std::vector<uint8_t>>     m_opusBufferQueue;
-    std::recursive_mutex                m_opusMutex;
-    std::recursive_mutex                m_taskMutex;
-    std::recursive_mutex                m_audioTaskMutex;
+    // downlink opus waits here until the audio task decodes it
+    JitterBuffer                        m_jitterBuffer;
     TaskHandle_t                        m_audioTaskHandle = nullptr;
+    TaskHandle_t                        m_foregroundTaskHandle = nullptr;
+    TaskHandle_t                        m_decodeTaskHandle = nullptr;
+    // decoded pcm waiting for the speaker, filled by the decode task, drained by the audio task
+    std::unique_ptr<PacketRing>         m_pPcmRing;
+    // bumped for every tts stream, decode task resets when it sees a new one
+    std::atomic<uint32_t>               m_nDecodeStream{0};
+    uint32_t                            m_nDecoderStream = 0;
+    // stream whose last packet the decode task has pushed into the pcm ring
+    std::atomic<uint32_t>               m_nDrainedStream{0};
+    // stream whose last sample the audio task has seen played, PLAYBACK_DONE_EVENT is set once per stream
+    uint32_t                            m_nPlaybackDoneStream = 0;
+    // when the speaker dma runs out of what has been written to it
+    int64_t                             m_speakerDrainTime = 0;
+    int64_t                             m_ttsStopTime = 0;
+    // last audio loop found a decoded frame to play
+    bool                                m_bPlaying = false;
+    // audio task stats are only touched by the audio task, the report runs there too.
+    // decode time and speech end to tts are written by the decode and recv tasks, under m_statsMutex
+    std::mutex                          m_statsMutex;
+    LatencyStat                         m_decodeTime;
+    // frames in the pcm ring when one is taken for playback
+    LatencyStat                         m_pcmOccupancy;
+    uint32_t                            m_nPcmUnderruns = 0;
+    LatencyStat                         m_micToUplink;
+    LatencyStat                         m_packetToSpeaker;
+    // end of the last utterance to the first tts packet
+    LatencyStat                         m_speechEndToTts;
+    std::atomic<int64_t>                m_utteranceEndTime{0};
+    Endpointer                          m_endpointer{UPLINK_VAD_HANGOVER_MS, UPLINK_MIN_SPEECH_MS};
+    // ring of opus frames encoded while silent, vectors keep their capacity
+    std::array<std::vector<uint8_t>, UPLINK_PREROLL_FRAMES> m_uplinkPreroll;
+    size_t                              m_nPrerollHead = 0;
+    size_t                              m_nPrerollCount = 0;
+    uint32_t                            m_nUplinkSent = 0;
+    uint32_t                            m_nUplinkSuppressed = 0;
+    ListeningMode                       m_eListeningMode = AutoStop;
+    // listen stop was sent at the end of the last utterance
+    std::atomic<bool>                   m_bListenStopped{false};
+    // decode task output, kept across frames so its capacity is reused
+    std::vector<int16_t>                m_playPCM;
+    // mic vectors handed out by the driver, the one allocation per tick left on the mic side
+    uint32_t                            m_nMicBlocks = 0;
+    PcmPoolStats                        m_lastPoolStats;
+    int64_t                             m_lastAllocLogTime = 0;
+    // shared by wake word detection and the uplink processor, declared before both
+    AudioFrontEnd                       m_frontEnd;
     WakeWordDetectAFE                   m_wakeWordDetect;
 #ifdef CONFIG_AUDIO_PROCESSING
     AudioProcessor                      m_audioProcessor;
-    AudioBuffer                         m_loopbackBuffer;
+    AecReference                        m_aecReference;
     OpusResampler                       m_speakerResampler;
 #endif
     EventGroupHandle_t                  m_eventGroup = nullptr;
     std::atomic<DeviceState>            m_eDeviceState = Idle;
-    std::list<std::function<void()>>    m_bgTasks;
-    std::list<std::function<void()>>    m_audioTasks;
+    // run by loop() and by the audio task
+    TaskExecutor                        m_foregroundTasks{"foreground"};
+    TaskExecutor                        m_audioTasks{"audio"};
     uint16_t                            m_pcmFrameSize = 512;
+    // decode task holds it while decoding, reconfigureAudio while swapping the decoder, the pcm
+    // ring and the jitter ring, the jitter producers around each call into the buffer
+    std::mutex                          m_codecMutex;
     std::unique_ptr<OpusDecoderWrapper> m_pOpusDecoder;
-    std::unique_ptr<OpusEncoderWrapper> m_pOpusEncoder;
+    std::unique_ptr<UplinkEncoder>      m_pOpusEncoder;
+    RateController                      m_rateController;
+    TxStats                             m_lastTxStats;
+    int64_t                             m_lastRateControlTime = 0;
+    // encode time of the audio task since the last rate control update
+    uint32_t                            m_nAudioBusyUs = 0;
     uint16_t                            m_opusFrameSize = 960;
+    // negotiated in the hello exchange
+    uint16_t                            m_nFrameDuration = 0;
+    uint16_t                            m_nDecodeRate = 0;
+    std::atomic<uint8_t>                m_nFramesPerPacket{1};
+    std::vector<uint8_t>                m_uplinkBatch;
+    uint8_t                             m_nBatchedFrames = 0;
     bool                                m_bAutoWakeOnReconnect = false;
     std::string                         m_sLastWakeWord;
     TTSCallback                         m_ttsCallback = nullptr;
     LLMCallback                         m_llmCallback = nullptr;
     StateCallback                       m_stateCallback = nullptr;
     ConnectionCallback                  m_connectionCallback = nullptr;
-    std::unordered_map<std::string, std::function<void(Rpc__Request*)>> m_rpcHandlers;
-    uint32_t                            m_lastPingTime = 0;
     MCPServer*                          m_pMcpServer = nullptr;
+    // indexed by RpcMsgId, built at compile time
+    static const RpcHandlerTable        s_rpcHandlers;
 };
 
 
@@ -0,0 +1,180 @@
+#include "jitter_buffer.h"
+#include "utils/logger.h"
+
+JitterBuffer::JitterBuffer(const JitterBufferConfig& config)
+: m_baseConfig(config), m_config(config) {
+    m_ring = std::make_unique<PacketRing>(m_config.capacity, m_config.slotSize);
+    // start cautious, decays to what the network needs once playback is stable
+    m_nJitterDepth = m_config.minDepth;
+    m_nUnderrunDepth = m_config.initDepth;
+}
+
+void JitterBuffer::setFrameDuration(uint16_t ms) {
+    if (ms == 0 || ms == m_config.frameDurationMs) {
+        return;
+    }
+    uint16_t baseMs = m_baseConfig.frameDurationMs;
+    auto scale = [baseMs, ms](uint16_t frames) {
+        uint32_t scaled = (uint32_t)frames * baseMs / ms;
+        return (uint16_t)(scaled ? scaled : 1);
+    };
+    m_config.frameDurationMs = ms;
+    m_config.minDepth = scale(m_baseConfig.minDepth);
+    m_config.maxDepth = scale(m_baseConfig.maxDepth);
+    m_config.initDepth = scale(m_baseConfig.initDepth);
+    m_config.capacity = scale(m_baseConfig.capacity);
+    m_config.maxConcealFrames = scale(m_baseConfig.maxConcealFrames);
+    m_config.stableFrames = scale(m_baseConfig.stableFrames);
+    // shorter frames make smaller packets, ring memory stays about the same
+    uint32_t slotSize = (uint32_t)m_baseConfig.slotSize * ms / baseMs;
+    m_config.slotSize = slotSize < 256 ? 256 : slotSize;
+    m_ring = std::make_unique<PacketRing>(m_config.capacity, m_config.slotSize);
+    m_lastArrival = 0;
+    m_jitter = 0;
+    m_nJitterDepth = m_config.minDepth;
+    m_nUnderrunDepth = m_config.initDepth;
+}
+
+void JitterBuffer::start() {
+    m_bEndOfStream = false;
+    m_bEndOfSentence = false;
+    // gap between two streams says nothing about the network
+    m_lastArrival = 0;
+    m_ring->discardAll();
+    m_nStream.fetch_add(1, std::memory_order_release);
+}
+
+void JitterBuffer::endOfStream() {
+    m_bEndOfStream = true;
+}
+
+void JitterBuffer::endOfSentence() {
+    m_bEndOfSentence = true;
+}
+
+bool JitterBuffer::push(const uint8_t* data, size_t len, int64_t nowUs) {
+    if (len > m_ring->getSlotSize()) {
+        LOGW("opus packet too large: %zu\n", len);
+        m_nOverruns++;
+        return true;
+    }
+    if (full()) {
+        return false;
+    }
+    int64_t frameUs = m_config.frameDurationMs * 1000;
+    // only gaps while the buffer is running low matter, server sends tts faster than realtime
+    // so packets arriving during a burst would only inflate the estimate
+    if (m_lastArrival && m_ring->size() <= targetDepth()) {
+        int64_t late = nowUs - m_lastArrival - frameUs;
+        if (late < 0)
+            late = 0;
+        // a long pause between sentences is capped, it rebuffers anyway
+        if (late > m_config.maxDepth * frameUs)
+            late = m_config.maxDepth * frameUs;
+        m_jitter += (late - m_jitter) / 16;
+        // enough frames to ride out twice the typical lateness, plus the one being played
+        m_nJitterDepth = (2 * m_jitter + frameUs - 1) / frameUs + 1;
+    }
+    m_lastArrival = nowUs;
+    // only the producer fills the ring, the room checked above is still there
+    m_ring->push(data, len, (uint32_t)nowUs);
+    m_nPushed++;
+    // pushed first, the consumer never sees an empty ring without the marker in between
+    m_bEndOfSentence = false;
+    return true;
+}
+
+JitterResult JitterBuffer::pop(std::vector<uint8_t>& out, uint32_t* arrivalUs) {
+    uint32_t stream = m_nStream.load(std::memory_order_acquire);
+    if (stream != m_nConsumerStream) {
+        m_nConsumerStream = stream;
+        m_bPlaying = false;
+        m_nConcealed = 0;
+        m_bStreamClean = true;
+    }
+    if (!m_bPlaying) {
+        size_t depth = m_ring->size();
+        // the tail of a sentence or stream is played right away, more isn't coming soon
+        if (depth == 0 || (depth < targetDepth() && !m_bEndOfStream && !m_bEndOfSentence)) {
+            return JITTER_WAIT;
+        }
+        m_bPlaying = true;
+    }
+    size_t len = 0;
+    const uint8_t* data = m_ring->front(&len, arrivalUs);
+    if (!data) {
+        if (m_bEndOfStream || m_bEndOfSentence) {
+            // natural pause, nothing is late. next sentence buffers up to target depth again
+            m_bPlaying = false;
+            m_nConcealed = 0;
+            if (m_bEndOfStream && m_bStreamClean) {
+                // short replies never reach stableFrames, a clean one still lets the depth come down
+                m_bStreamClean = false;
+                if (m_nUnderrunDepth > m_config.minDepth) {
+                    m_nUnderrunDepth--;
+                }
+            }
+            return JITTER_WAIT;
+        }
+        if (m_nConcealed < m_config.maxConcealFrames) {
+            m_nConcealed++;
+            m_nConcealedTotal++;
+            return JITTER_CONCEAL;
+        }
+        // packet is too late to hide, wait for target depth again and ask for a deeper buffer
+        m_bPlaying = false;
+        m_nConcealed = 0;
+        m_nStablePlayed = 0;
+        m_bStreamClean = false;
+        m_nUnderruns++;
+        if (m_nUnderrunDepth < m_config.maxDepth)
+            m_nUnderrunDepth++;
+        LOGW("jitter buffer underrun, target depth: %d\n", targetDepth());
+        return JITTER_WAIT;
+    }
+    out.assign(data, data + len);
+    m_ring->pop();
+    m_nConcealed = 0;
+    m_nPlayed++;
+    if (++m_nStablePlayed >= m_config.stableFrames) {
+        m_nStablePlayed = 0;
+        if (m_nUnderrunDepth > m_config.minDepth) {
+            m_nUnderrunDepth--;
+        }
+    }
+    return JITTER_FRAME;
+}
+
+bool JitterBuffer::empty() {
+    return m_ring->size() == 0;
+}
+
+bool JitterBuffer::drained() {
+    return m_bEndOfStream && m_ring->size() == 0;
+}
+
+JitterBufferStats JitterBuffer::getStats() {
+    JitterBufferStats stats;
+    stats.pushed = m_nPushed;
+    stats.played = m_nPlayed;
+    stats.concealed = m_nConcealedTotal;
+    stats.underruns = m_nUnderruns;
+    stats.overruns = m_nOverruns;
+    stats.depth = m_ring->size();
+    stats.targetDepth = targetDepth();
+    // read from another task, fine for a log line
+    stats.jitter = m_jitter;
+    return stats;
+}
+
+uint16_t JitterBuffer::targetDepth() const {
+    uint16_t depth = m_nJitterDepth;
+    uint16_t underrunDepth = m_nUnderrunDepth;
+    if (depth < underrunDepth)
+        depth = underrunDepth;
+    if (depth < m_config.minDepth)
+        depth = m_config.minDepth;
+    if (depth > m_config.maxDepth)
+        depth = m_config.maxDepth;
+    return depth;
+}
@@ -0,0 +1,114 @@
+#ifndef _JITTER_BUFFER_H_
+#define _JITTER_BUFFER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include "packet_ring.h"
+
+// frame counts below are for frameDurationMs, setFrameDuration rescales them
+struct JitterBufferConfig {
+    uint16_t    frameDurationMs = 60;
+    // target depth in frames stays in [minDepth, maxDepth]
+    uint16_t    minDepth = 2;
+    uint16_t    maxDepth = 8;
+    uint16_t    initDepth = 3;
+    // ring slots, 12s of 60ms frames. tts is sent faster than realtime, a full ring makes the
+    // producer wait for playback instead of dropping, see push()
+    uint16_t    capacity = 200;
+    // largest opus packet accepted
+    uint16_t    slotSize = 1024;
+    // consecutive PLC frames before giving up and rebuffering to target depth
+    uint16_t    maxConcealFrames = 3;
+    // frames played without underrun before target depth is lowered by one
+    uint16_t    stableFrames = 100;
+};
+
+struct JitterBufferStats {
+    uint32_t    pushed = 0;
+    uint32_t    played = 0;
+    uint32_t    concealed = 0;
+    uint32_t    underruns = 0;
+    uint32_t    overruns = 0;
+    uint16_t    depth = 0;
+    uint16_t    targetDepth = 0;
+    // smoothed lateness of arrivals, in us
+    uint32_t    jitter = 0;
+};
+
+enum JitterResult : uint8_t {
+    // nothing to play, buffer is filling up or stream is over
+    JITTER_WAIT = 0,
+    // out holds the next packet
+    JITTER_FRAME,
+    // next packet is late, decode an empty packet to let opus conceal the gap
+    JITTER_CONCEAL
+};
+
+// Playout buffer for downlink opus. Playback starts once target depth is buffered,
+// a late packet is covered by a few PLC frames, a longer gap rebuffers. Target depth
+// follows arrival jitter, is raised on every underrun and decays while playback is stable.
+// Running dry after the end of a sentence or of the stream is a pause, not an underrun:
+// nothing is concealed and the target depth is left alone.
+// Transport is tcp so packets never arrive out of order or go missing, only late.
+// Lock free: start/endOfStream/push from the receive task, pop from the audio task.
+class JitterBuffer {
+public:
+    JitterBuffer(const JitterBufferConfig& config = JitterBufferConfig());
+    // negotiated frame duration, depths and ring keep the same amount of audio.
+    // producer side, only while nothing is being played
+    void setFrameDuration(uint16_t ms);
+    // new stream, queued packets are dropped. adaptive target depth is kept
+    void start();
+    // no more packets for this stream, play out the rest without waiting for target depth
+    void endOfStream();
+    // the current sentence is complete, the gap before the next one is expected.
+    // cleared by the next push
+    void endOfSentence();
+    // false when the ring is full and nothing was queued, the caller waits for playback and
+    // pushes again, or gives the frame up with dropFrame(). a packet larger than a slot is
+    // dropped and counted right away
+    bool push(const uint8_t* data, size_t len, int64_t nowUs);
+    // producer gave up on a frame the ring had no room for
+    void dropFrame() { m_nOverruns++; }
+    bool full() const { return m_ring->size() >= m_ring->getSlotCount(); }
+    // arrivalUs gets the low 32 bits of the push time of a JITTER_FRAME
+    JitterResult pop(std::vector<uint8_t>& out, uint32_t* arrivalUs = nullptr);
+    bool empty();
+    // end of stream was signalled and every packet of it has been popped
+    bool drained();
+    JitterBufferStats getStats();
+private:
+    uint16_t targetDepth() const;
+
+    // as constructed, what setFrameDuration scales from
+    JitterBufferConfig              m_baseConfig;
+    JitterBufferConfig              m_config;
+    std::unique_ptr<PacketRing>     m_ring;
+    std::atomic<bool>               m_bEndOfStream{false};
+    std::atomic<bool>               m_bEndOfSentence{false};
+    // bumped by start, consumer resets its playout state when it sees a new stream
+    std::atomic<uint32_t>           m_nStream{0};
+    // producer side
+    int64_t                         m_lastArrival = 0;
+    // rfc3550 style estimator, in us
+    int64_t                         m_jitter = 0;
+    std::atomic<uint16_t>           m_nJitterDepth{0};
+    std::atomic<uint32_t>           m_nPushed{0};
+    std::atomic<uint32_t>           m_nOverruns{0};
+    // consumer side
+    uint32_t                        m_nConsumerStream = 0;
+    bool                            m_bPlaying = false;
+    uint16_t                        m_nConcealed = 0;
+    uint16_t                        m_nStablePlayed = 0;
+    // no underrun since the stream started, its clean end lowers the target depth
+    bool                            m_bStreamClean = false;
+    // raised by underruns, decays while playback is stable
+    std::atomic<uint16_t>           m_nUnderrunDepth{0};
+    std::atomic<uint32_t>           m_nPlayed{0};
+    std::atomic<uint32_t>           m_nConcealedTotal{0};
+    std::atomic<uint32_t>           m_nUnderruns{0};
+};
+
+#endif
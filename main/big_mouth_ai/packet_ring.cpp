@@ -0,0 +1,83 @@
+#include "packet_ring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "utils/logger.h"
+#include "core/memory_allocator.h"
+
+// every slot starts with the packet length and tag
+struct SlotHeader {
+    uint16_t    len;
+    uint32_t    tag;
+};
+#define SLOT_HEADER_SIZE sizeof(SlotHeader)
+
+PacketRing::PacketRing(uint16_t slotCount, uint16_t slotSize)
+: m_nSlotCount(slotCount), m_nSlotSize(slotSize) {
+    m_nStride = (SLOT_HEADER_SIZE + slotSize + 3) & ~(size_t)3;
+    m_pSlots = (uint8_t*)psram_prefered_malloc(m_nStride * slotCount);
+    assert(m_pSlots);
+}
+
+PacketRing::~PacketRing() {
+    if (m_pSlots) {
+        free(m_pSlots);
+        m_pSlots = nullptr;
+    }
+}
+
+bool PacketRing::push(const uint8_t* data, size_t len, uint32_t tag) {
+    if (len > m_nSlotSize) {
+        return false;
+    }
+    uint32_t w = m_write.load(std::memory_order_relaxed);
+    // discarded slots may still be read by the consumer until it skips them, so only read index frees space
+    if (w - m_read.load(std::memory_order_acquire) >= m_nSlotCount) {
+        return false;
+    }
+    uint8_t* s = slot(w);
+    SlotHeader header = {(uint16_t)len, tag};
+    memcpy(s, &header, SLOT_HEADER_SIZE);
+    memcpy(s + SLOT_HEADER_SIZE, data, len);
+    m_write.store(w + 1, std::memory_order_release);
+    return true;
+}
+
+void PacketRing::discardAll() {
+    m_discard.store(m_write.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+const uint8_t* PacketRing::front(size_t* len, uint32_t* tag) {
+    uint32_t r = m_read.load(std::memory_order_relaxed);
+    uint32_t d = m_discard.load(std::memory_order_acquire);
+    if ((int32_t)(d - r) > 0) {
+        r = d;
+        m_read.store(r, std::memory_order_release);
+    }
+    if (r == m_write.load(std::memory_order_acquire)) {
+        return nullptr;
+    }
+    uint8_t* s = slot(r);
+    SlotHeader header;
+    memcpy(&header, s, SLOT_HEADER_SIZE);
+    *len = header.len;
+    if (tag)
+        *tag = header.tag;
+    return s + SLOT_HEADER_SIZE;
+}
+
+void PacketRing::pop() {
+    uint32_t r = m_read.load(std::memory_order_relaxed);
+    if (r != m_write.load(std::memory_order_acquire)) {
+        m_read.store(r + 1, std::memory_order_release);
+    }
+}
+
+size_t PacketRing::size() const {
+    uint32_t r = m_read.load(std::memory_order_acquire);
+    uint32_t d = m_discard.load(std::memory_order_acquire);
+    if ((int32_t)(d - r) > 0) {
+        r = d;
+    }
+    return m_write.load(std::memory_order_acquire) - r;
+}
@@ -0,0 +1,38 @@
+#ifndef _PACKET_RING_H_
+#define _PACKET_RING_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+
+// Fixed capacity single producer / single consumer ring of packet slots.
+// Slots are allocated once in PSRAM, push and pop only copy into/out of them,
+// both sides are wait free and never touch the heap after construction.
+class PacketRing {
+public:
+    PacketRing(uint16_t slotCount, uint16_t slotSize);
+    ~PacketRing();
+    // Producer: false when ring is full or packet doesn't fit a slot. tag is handed back by front()
+    bool push(const uint8_t* data, size_t len, uint32_t tag = 0);
+    // Producer: everything pushed so far is skipped by the consumer
+    void discardAll();
+    // Consumer: oldest packet, nullptr if empty. valid until pop()
+    const uint8_t* front(size_t* len, uint32_t* tag = nullptr);
+    void pop();
+    // either side, may be stale by one packet
+    size_t size() const;
+    uint16_t getSlotSize() const { return m_nSlotSize; }
+    uint16_t getSlotCount() const { return m_nSlotCount; }
+private:
+    uint8_t* slot(uint32_t index) const { return m_pSlots + (size_t)(index % m_nSlotCount) * m_nStride; }
+
+    uint8_t*                m_pSlots = nullptr;
+    uint16_t                m_nSlotCount;
+    uint16_t                m_nSlotSize;
+    size_t                  m_nStride;
+    // free running indices, wrap around is fine as only differences are used
+    std::atomic<uint32_t>   m_write{0};
+    std::atomic<uint32_t>   m_read{0};
+    std::atomic<uint32_t>   m_discard{0};
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "rate_controller.h"
+
+RateController::RateController(const RateControlConfig& config) : m_config(config) {
+    m_decision.bitrate = m_config.startBitrate;
+    m_decision.complexity = m_config.startComplexity;
+}
+
+const RateDecision& RateController::update(const RateSample& sample) {
+    m_bCongested = sample.queueDepth >= m_config.queueDepthHigh || sample.dropped > 0 ||
+        sample.sendLatencyUs > m_config.sendLatencyHighUs || sample.rttUs > m_config.rttHighUs;
+    if (m_bCongested) {
+        // back off fast, the queue is what adds latency
+        m_nStable = 0;
+        m_decision.bitrate = m_decision.bitrate * m_config.decreasePercent / 100;
+        if (m_decision.bitrate < m_config.minBitrate)
+            m_decision.bitrate = m_config.minBitrate;
+    } else if (++m_nStable >= m_config.stableUpdates) {
+        m_nStable = 0;
+        m_decision.bitrate += m_config.bitrateStep;
+        if (m_decision.bitrate > m_config.maxBitrate)
+            m_decision.bitrate = m_config.maxBitrate;
+    }
+
+    // frames dropped by the queue can be rebuilt from the next one when fec is on
+    uint32_t total = sample.sent + sample.dropped;
+    uint32_t loss = total ? sample.dropped * 100 / total : 0;
+    if (loss > m_decision.fecLoss) {
+        m_decision.fecLoss = loss > m_config.maxFecLoss ? m_config.maxFecLoss : loss;
+    } else if (!m_bCongested) {
+        m_decision.fecLoss /= 2;
+    }
+
+    if (sample.cpuLoad > m_config.cpuHigh && m_decision.complexity > m_config.minComplexity) {
+        m_decision.complexity--;
+    } else if (sample.cpuLoad < m_config.cpuLow && m_decision.complexity < m_config.maxComplexity) {
+        m_decision.complexity++;
+    }
+    return m_decision;
+}
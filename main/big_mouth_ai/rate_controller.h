@@ -0,0 +1,59 @@
+#ifndef _RATE_CONTROLLER_H_
+#define _RATE_CONTROLLER_H_
+#include <stdint.h>
+
+struct RateControlConfig {
+    int         minBitrate = 12000;
+    int         maxBitrate = 32000;
+    int         startBitrate = 24000;
+    // additive increase per stable period, multiplicative decrease on congestion
+    int         bitrateStep = 2000;
+    uint8_t     decreasePercent = 75;
+    // consecutive clean updates before bitrate is raised
+    uint8_t     stableUpdates = 3;
+    uint8_t     minComplexity = 0;
+    uint8_t     maxComplexity = 5;
+    uint8_t     startComplexity = 3;
+    uint8_t     maxFecLoss = 20;
+    // any of these means the link is not keeping up
+    uint16_t    queueDepthHigh = 3;
+    uint32_t    sendLatencyHighUs = 150 * 1000;
+    uint32_t    rttHighUs = 500 * 1000;
+    // audio task busy percentage bounds for complexity
+    uint8_t     cpuHigh = 70;
+    uint8_t     cpuLow = 40;
+};
+
+// what happened since the previous update
+struct RateSample {
+    uint16_t    queueDepth = 0;
+    uint32_t    sent = 0;
+    uint32_t    dropped = 0;
+    uint32_t    sendLatencyUs = 0;
+    uint32_t    rttUs = 0;
+    uint8_t     cpuLoad = 0;
+};
+
+struct RateDecision {
+    int         bitrate = 0;
+    uint8_t     complexity = 0;
+    // expected loss for in band fec, 0 is off
+    uint8_t     fecLoss = 0;
+};
+
+// AIMD bitrate control of the uplink encoder from tx queue, send latency and ping rtt,
+// complexity follows audio task load, fec follows the packets the tx queue dropped.
+class RateController {
+public:
+    RateController(const RateControlConfig& config = RateControlConfig());
+    const RateDecision& update(const RateSample& sample);
+    const RateDecision& current() const { return m_decision; }
+    bool isCongested() const { return m_bCongested; }
+private:
+    RateControlConfig   m_config;
+    RateDecision        m_decision;
+    uint8_t             m_nStable = 0;
+    bool                m_bCongested = false;
+};
+
+#endif
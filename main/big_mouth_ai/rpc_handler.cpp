@@ -1,21 +1,36 @@
 #include "big_mouth_ai.h"
+#include "socket/message_arena.h"
 
 #define DEFINE_RPC_HANDLER(proto, pre_fix, funcBody) \
 void BigMouthAI::on##proto(Rpc__Request* req) { \
-    auto msg = pre_fix##__unpack(nullptr, req->serialized_data.len, req->serialized_data.data); \
+    auto allocator = MessageArena::currentAllocator(); \
+    auto msg = pre_fix##__unpack(allocator, req->serialized_data.len, req->serialized_data.data); \
     funcBody \
-    pre_fix##__free_unpacked(msg, nullptr); \
+    pre_fix##__free_unpacked(msg, allocator); \
 }
 
 #define REGISTER_RPC_HANDLER(proto) \
-    m_rpcHandlers[#proto] = std::bind(&BigMouthAI::on##proto, this, std::placeholders::_1);
-
-void BigMouthAI::registerRpcHandler() {
-    REGISTER_RPC_HANDLER(Rpc__LoginResult);
-    REGISTER_RPC_HANDLER(Rpc__AssistantConfig);
-    REGISTER_RPC_HANDLER(Rpc__Msg);
-    REGISTER_RPC_HANDLER(Rpc__BytesMsg);
-    REGISTER_RPC_HANDLER(Rpc__Configs);
+    handlers[RPC_MSG_ID_##proto] = &BigMouthAI::onRpc__##proto;
+
+constexpr BigMouthAI::RpcHandlerTable BigMouthAI::makeRpcHandlerTable() {
+    RpcHandlerTable handlers{};
+    REGISTER_RPC_HANDLER(LoginResult)
+    REGISTER_RPC_HANDLER(AssistantConfig)
+    REGISTER_RPC_HANDLER(Msg)
+    REGISTER_RPC_HANDLER(BytesMsg)
+    REGISTER_RPC_HANDLER(Configs)
+    return handlers;
+}
+
+constexpr BigMouthAI::RpcHandlerTable BigMouthAI::s_rpcHandlers = BigMouthAI::makeRpcHandlerTable();
+
+void BigMouthAI::onRequest(Rpc__Request* request, uint16_t msgId) {
+    RpcHandler handler = msgId < RPC_MSG_ID_COUNT ? s_rpcHandlers[msgId] : nullptr;
+    if (handler) {
+        (this->*handler)(request);
+    } else if (msgId != RPC_MSG_ID_Ping) {
+        LOGE("Missing handler function for message: %d", msgId);
+    }
 }
 
 DEFINE_RPC_HANDLER(Rpc__LoginResult, rpc__login_result, {
@@ -28,10 +43,12 @@ DEFINE_RPC_HANDLER(Rpc__Configs, rpc__configs, {
 
 DEFINE_RPC_HANDLER(Rpc__AssistantConfig, rpc__assistant_config, {
     auto root = cJSON_Parse(msg->json);
-    if (root)
+    if (root) {
         onServerHello(root);
-    else
+        cJSON_Delete(root);
+    } else {
         printf("json parse error: %s\n", msg->json);
+    }
 })
 
 DEFINE_RPC_HANDLER(Rpc__Msg, rpc__msg, {
@@ -0,0 +1,83 @@
+#include "uplink_encoder.h"
+#include <string.h>
+#include "opus.h"
+#include "utils/logger.h"
+
+// largest packet opus produces for one frame
+#define UPLINK_MAX_PACKET 1275
+
+UplinkEncoder::UplinkEncoder(int sampleRate, int channels, int frameDurationMs, int bitrate) {
+    int error = 0;
+    m_pEncoder = opus_encoder_create(sampleRate, channels, OPUS_APPLICATION_VOIP, &error);
+    if (!m_pEncoder) {
+        LOGE("failed to create opus encoder: %d\n", error);
+        return;
+    }
+    opus_encoder_ctl(m_pEncoder, OPUS_SET_SIGNAL(OPUS_SIGNAL_VOICE));
+    m_nFrameSamples = sampleRate / 1000 * channels * frameDurationMs;
+    m_frame.resize(m_nFrameSamples);
+    m_packet.resize(UPLINK_MAX_PACKET);
+    setBitrate(bitrate);
+    setComplexity(3);
+    setFec(0);
+}
+
+UplinkEncoder::~UplinkEncoder() {
+    if (m_pEncoder) {
+        opus_encoder_destroy(m_pEncoder);
+    }
+}
+
+void UplinkEncoder::encode(const int16_t* pcm, size_t samples, const std::function<void(const uint8_t* opus, size_t len)>& handler) {
+    if (!m_pEncoder) {
+        return;
+    }
+    while (samples > 0) {
+        size_t n = m_nFrameSamples - m_nFill;
+        if (n > samples)
+            n = samples;
+        memcpy(m_frame.data() + m_nFill, pcm, n * sizeof(int16_t));
+        m_nFill += n;
+        pcm += n;
+        samples -= n;
+        if (m_nFill < m_nFrameSamples) {
+            break;
+        }
+        m_nFill = 0;
+        auto len = opus_encode(m_pEncoder, m_frame.data(), m_nFrameSamples, m_packet.data(), m_packet.size());
+        if (len < 0) {
+            LOGE("opus encode error: %d\n", len);
+            continue;
+        }
+        handler(m_packet.data(), len);
+    }
+}
+
+void UplinkEncoder::resetState() {
+    m_nFill = 0;
+    if (m_pEncoder) {
+        opus_encoder_ctl(m_pEncoder, OPUS_RESET_STATE);
+    }
+}
+
+void UplinkEncoder::setBitrate(int bitrate) {
+    m_nBitrate = bitrate;
+    if (m_pEncoder) {
+        opus_encoder_ctl(m_pEncoder, OPUS_SET_BITRATE(bitrate));
+    }
+}
+
+void UplinkEncoder::setComplexity(int complexity) {
+    m_nComplexity = complexity;
+    if (m_pEncoder) {
+        opus_encoder_ctl(m_pEncoder, OPUS_SET_COMPLEXITY(complexity));
+    }
+}
+
+void UplinkEncoder::setFec(int lossPercent) {
+    m_nFecLoss = lossPercent;
+    if (m_pEncoder) {
+        opus_encoder_ctl(m_pEncoder, OPUS_SET_INBAND_FEC(lossPercent > 0 ? 1 : 0));
+        opus_encoder_ctl(m_pEncoder, OPUS_SET_PACKET_LOSS_PERC(lossPercent));
+    }
+}
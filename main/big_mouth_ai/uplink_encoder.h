@@ -0,0 +1,39 @@
+#ifndef _UPLINK_ENCODER_H_
+#define _UPLINK_ENCODER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <functional>
+
+struct OpusEncoder;
+
+// Mic side opus encoder with runtime bitrate, complexity and in band fec.
+// OpusEncoderWrapper hides its encoder so none of those can be changed after creation.
+// Not thread safe, used by the audio task only.
+class UplinkEncoder {
+public:
+    UplinkEncoder(int sampleRate, int channels, int frameDurationMs, int bitrate);
+    ~UplinkEncoder();
+    // pcm of any length, handler gets one packet for every complete frame
+    void encode(const int16_t* pcm, size_t samples, const std::function<void(const uint8_t* opus, size_t len)>& handler);
+    // drop the partial frame and the predictor state
+    void resetState();
+    void setBitrate(int bitrate);
+    void setComplexity(int complexity);
+    // fec sized for the expected loss percentage, 0 turns it off
+    void setFec(int lossPercent);
+    int getBitrate() const { return m_nBitrate; }
+    int getComplexity() const { return m_nComplexity; }
+    int getFec() const { return m_nFecLoss; }
+private:
+    OpusEncoder*            m_pEncoder = nullptr;
+    size_t                  m_nFrameSamples = 0;
+    std::vector<int16_t>    m_frame;
+    size_t                  m_nFill = 0;
+    std::vector<uint8_t>    m_packet;
+    int                     m_nBitrate = 0;
+    int                     m_nComplexity = 0;
+    int                     m_nFecLoss = 0;
+};
+
+#endif
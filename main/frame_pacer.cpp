@@ -0,0 +1,86 @@
+#include "frame_pacer.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_timer.h"
+
+void FrameTimeStats::add(uint32_t us, bool active) {
+    uint32_t bucket = us / 1000;
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+    histogram[bucket]++;
+    frames++;
+    if (active) {
+        activeFrames++;
+    }
+    if (us > maxUs) {
+        maxUs = us;
+    }
+}
+
+uint32_t FrameTimeStats::percentileMs(uint8_t percent) const {
+    if (!frames) {
+        return 0;
+    }
+    // rank of the frame at the percentile, 1 based
+    uint32_t rank = ((uint64_t)frames * percent + 99) / 100;
+    uint32_t seen = 0;
+    for (uint16_t i = 0; i < BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank) {
+            return i + 1;
+        }
+    }
+    return BUCKETS;
+}
+
+FramePacer::FramePacer(uint16_t activeFps, uint16_t idleFps, uint32_t holdMs) {
+    m_activePeriodUs = 1000000 / activeFps;
+    m_idlePeriodUs = 1000000 / idleFps;
+    m_holdUs = (int64_t)holdMs * 1000;
+}
+
+void FramePacer::waitNextFrame() {
+    int64_t now = esp_timer_get_time();
+    // deadlines advance by whole periods, tick rounding averages out instead of adding up
+    m_nextFrame += m_bActive ? m_activePeriodUs : m_idlePeriodUs;
+    if (m_nextFrame < now - m_activePeriodUs) {
+        // fell behind, no burst of catch up frames
+        m_nextFrame = now;
+    }
+    int64_t tickUs = portTICK_PERIOD_MS * 1000;
+    TickType_t ticks = (m_nextFrame - now + tickUs / 2) / tickUs;
+    if (m_nextFrame > now && ticks) {
+        ulTaskNotifyTake(pdTRUE, ticks);
+        now = esp_timer_get_time();
+        // woken for posted work, still not faster than the active rate
+        int64_t earliest = m_frameStart + m_activePeriodUs;
+        if (now < m_nextFrame) {
+            m_nextFrame = now > earliest ? now : earliest;
+            ticks = (m_nextFrame - now + tickUs / 2) / tickUs;
+            if (ticks) {
+                vTaskDelay(ticks);
+            }
+        }
+    } else {
+        // overran, still give lower priority tasks on this core a tick
+        vTaskDelay(1);
+    }
+}
+
+void FramePacer::beginFrame() {
+    m_frameStart = esp_timer_get_time();
+    if (!m_nextFrame) {
+        m_nextFrame = m_frameStart;
+        m_lastActivity = m_frameStart;
+    }
+}
+
+void FramePacer::endFrame(bool active) {
+    int64_t now = esp_timer_get_time();
+    if (active) {
+        m_lastActivity = now;
+    }
+    m_bActive = now - m_lastActivity < m_holdUs;
+    m_stats.add(now - m_frameStart, active);
+}
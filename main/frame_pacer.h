@@ -0,0 +1,45 @@
+#ifndef _FRAME_PACER_H_
+#define _FRAME_PACER_H_
+#include <stdint.h>
+#include <array>
+
+// frame work time in 1ms buckets, the last one collects everything slower
+struct FrameTimeStats {
+    static constexpr uint16_t BUCKETS = 100;
+    std::array<uint32_t, BUCKETS> histogram{};
+    uint32_t    frames = 0;
+    uint32_t    activeFrames = 0;
+    uint32_t    maxUs = 0;
+    void add(uint32_t us, bool active);
+    // upper edge of the bucket holding the given percentile, in ms
+    uint32_t percentileMs(uint8_t percent) const;
+    void reset() { *this = FrameTimeStats(); }
+};
+
+// Paces the render task. Frames run at activeFps while something is moving or the
+// device is talking, at idleFps once nothing was active for holdMs. A task notification
+// ends an idle wait early so posted ui work is shown without waiting for the next idle frame.
+class FramePacer {
+public:
+    FramePacer(uint16_t activeFps, uint16_t idleFps, uint32_t holdMs = 1000);
+    // render task only, blocks until the next frame is due
+    void waitNextFrame();
+    void beginFrame();
+    // active keeps the active rate for another holdMs
+    void endFrame(bool active);
+    bool isActive() const { return m_bActive; }
+    // read from another task, fine for a log line
+    const FrameTimeStats& getStats() const { return m_stats; }
+    void resetStats() { m_stats.reset(); }
+private:
+    int64_t                 m_activePeriodUs;
+    int64_t                 m_idlePeriodUs;
+    int64_t                 m_holdUs;
+    int64_t                 m_frameStart = 0;
+    int64_t                 m_nextFrame = 0;
+    int64_t                 m_lastActivity = 0;
+    bool                    m_bActive = true;
+    FrameTimeStats          m_stats;
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "utils/helper.h"
 #include "lvgl.h"
 #include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "js_binding/js_binding.h"
 #include <vector>
 #include <mbedtls/base64.h>
@@ -14,6 +15,8 @@
 #include "cubicat_spine.h"
 #include "ble_protocol.h"
 #include "ble_service_defines.h"
+#include "render_damage.h"
+#include "frame_pacer.h"
 
 using namespace cubicat;
 uint32_t g_bgNodeId = 0;
@@ -25,6 +28,40 @@ static lv_disp_drv_t disp_drv;      // contains callback functions
 static lv_indev_drv_t touch_drv;
 static lv_img_dsc_t buffer_desc;
 uint16_t* screenBuffer = nullptr;
+// pixels pushed to the lcd since the last report
+static uint32_t flushedPixels = 0;
+// display refresh stats since the last report
+static uint32_t refreshedFrames = 0;
+static uint32_t refreshTimeMs = 0;
+static uint32_t flushCount = 0;
+static uint64_t flushTimeUs = 0;
+// draw buffer setting the stats above were taken with
+static char flushMode[48] = "";
+#if CONFIG_LVGL_DOUBLE_BUFFER_FLUSH
+// one flush in flight at most, lvgl waits for flush ready before handing over the other buffer
+static TaskHandle_t flushTaskHandle = nullptr;
+static lv_disp_drv_t* flushDrv = nullptr;
+static lv_area_t flushArea;
+static lv_color_t* flushColors = nullptr;
+
+static void flush_task(void* arg) {
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        int64_t start = esp_timer_get_time();
+        CUBICAT.lcd.pushPixelsToScreen(flushArea.x1, flushArea.y1, flushArea.x2, flushArea.y2, (uint16_t*)flushColors);
+        flushTimeUs += esp_timer_get_time() - start;
+        flushCount++;
+        // transfer is done, lvgl may render into this buffer again
+        lv_disp_flush_ready(flushDrv);
+    }
+}
+#endif
+// screen stays on the active frame rate this long after a touch
+#define RENDER_TOUCH_HOLD_MS 1000
+static RenderDamage* renderDamage = nullptr;
+static uint32_t damagedPixels = 0;
+// one frame of ui work, engine and lvgl, set up by app_main. true if anything is moving
+static std::function<bool()> renderFrame;
 LV_FONT_DECLARE(yuanti_18);
 
 extern void Register_SPINE_API();
@@ -33,19 +70,86 @@ static void tick_task(void *arg) {
     lv_tick_inc(LVGL_TICK_PERIOD_MS);
 }
 
+static void render_task(void* arg) {
+    FramePacer pacer(CONFIG_RENDER_ACTIVE_FPS, CONFIG_RENDER_IDLE_FPS);
+    int64_t lastFlushReport = esp_timer_get_time();
+    while (true) {
+        pacer.beginFrame();
+        pacer.endFrame(renderFrame());
+        // averaged over a few seconds, reported as per second rates
+        int64_t nowUs = esp_timer_get_time();
+        if (nowUs - lastFlushReport >= 5000000) {
+            float seconds = (nowUs - lastFlushReport) / 1000000.0f;
+            auto& stats = pacer.getStats();
+            printf("lcd flushed pixels/s: %.0f engine damage pixels/s: %.0f\n", flushedPixels / seconds, damagedPixels / seconds);
+            printf("lcd fps: %.1f refresh avg: %ums flushes/s: %.0f flush avg: %uus, %s\n",
+                refreshedFrames / seconds, refreshedFrames ? refreshTimeMs / refreshedFrames : 0,
+                flushCount / seconds, flushCount ? (uint32_t)(flushTimeUs / flushCount) : 0, flushMode);
+            printf("render fps: %.1f (target %d/%d) frame p50: %ums p99: %ums max: %uus active: %u%%\n",
+                stats.frames / seconds, CONFIG_RENDER_ACTIVE_FPS, CONFIG_RENDER_IDLE_FPS,
+                stats.percentileMs(50), stats.percentileMs(99), stats.maxUs,
+                stats.frames ? stats.activeFrames * 100 / stats.frames : 0);
+            flushedPixels = 0;
+            refreshedFrames = 0;
+            refreshTimeMs = 0;
+            flushCount = 0;
+            flushTimeUs = 0;
+            damagedPixels = 0;
+            pacer.resetStats();
+            lastFlushReport = nowUs;
+        }
+        pacer.waitNextFrame();
+    }
+}
+
 void initLvglEnv() {
     lv_init();
+#if CONFIG_LVGL_DOUBLE_BUFFER_FLUSH
+    uint32_t bufPixels = CUBICAT.lcd.width() * CONFIG_LVGL_DRAW_BUFFER_LINES;
+    void* buf = heap_caps_malloc(bufPixels * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    void* buf2 = heap_caps_malloc(bufPixels * sizeof(lv_color_t), MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (!buf || !buf2) {
+        // still double buffered, only the transfer is slower out of PSRAM
+        printf("not enough internal dma memory for draw buffers, using psram\n");
+        free(buf);
+        free(buf2);
+        buf = psram_prefered_malloc(bufPixels * sizeof(lv_color_t));
+        buf2 = psram_prefered_malloc(bufPixels * sizeof(lv_color_t));
+    }
+    assert(buf && buf2);
+    snprintf(flushMode, sizeof(flushMode), "double buffer %d lines", CONFIG_LVGL_DRAW_BUFFER_LINES);
+    xTaskCreate(flush_task, "lcd flush", 1024 * 4, nullptr, 5, &flushTaskHandle);
+#else
     uint32_t bufPixels = CUBICAT.lcd.width() * CUBICAT.lcd.height();
     void* buf = psram_prefered_malloc(bufPixels * sizeof(lv_color_t));
+    void* buf2 = nullptr;
     assert(buf);
+    snprintf(flushMode, sizeof(flushMode), "single full screen buffer");
+#endif
     // initialize LVGL draw buffers
-    lv_disp_draw_buf_init(&disp_buf, buf, nullptr, bufPixels);
+    lv_disp_draw_buf_init(&disp_buf, buf, buf2, bufPixels);
     lv_disp_drv_init(&disp_drv);
     disp_drv.hor_res = CUBICAT.lcd.width();
     disp_drv.ver_res = CUBICAT.lcd.height();
     disp_drv.flush_cb = [](lv_disp_drv_t* drv, const lv_area_t* area, lv_color_t* color_p) {
+        flushedPixels += lv_area_get_size(area);
+#if CONFIG_LVGL_DOUBLE_BUFFER_FLUSH
+        // returns right away, lvgl renders the next part into the other buffer meanwhile
+        flushDrv = drv;
+        flushArea = *area;
+        flushColors = color_p;
+        xTaskNotifyGive(flushTaskHandle);
+#else
+        int64_t start = esp_timer_get_time();
         CUBICAT.lcd.pushPixelsToScreen(area->x1, area->y1, area->x2, area->y2, (uint16_t*)color_p);
+        flushTimeUs += esp_timer_get_time() - start;
+        flushCount++;
         lv_disp_flush_ready(drv);
+#endif
+    };
+    disp_drv.monitor_cb = [](lv_disp_drv_t* drv, uint32_t time, uint32_t px) {
+        refreshedFrames++;
+        refreshTimeMs += time;
     };
     disp_drv.draw_buf = &disp_buf;
     // disp_drv.screen_transp = 1;
@@ -309,10 +413,22 @@ extern "C" void app_main(void)
         }
     });
     MEMORY_REPORT
-    while (1)
-    {
-        bigMouth->loop();
+    renderDamage = new RenderDamage(CUBICAT.lcd.width(), CUBICAT.lcd.height());
+#if CONFIG_JAVASCRIPT_ENABLE
+    renderFrame = [bigMouth, backBufferObj]() {
+#else
+    renderFrame = [bigMouth, backBufferObj, h0Img, h1Img, m0Img, m1Img]() {
+#endif
+        // ui work posted by the ai and the mcp tools touches lvgl and the scene, so it runs here
+        bool active = bigMouth->runForegroundTasks();
         CUBICAT.loop(false);
+        // only what the engine changed is redrawn, lvgl adds the damage of its own overlay widgets
+        for (auto& rect : renderDamage->update((const uint16_t*)CUBICAT.lcd.getRenderBuffer().data)) {
+            lv_area_t area = {rect.x1, rect.y1, rect.x2, rect.y2};
+            lv_obj_invalidate_area(backBufferObj, &area);
+        }
+        uint32_t sceneDamage = renderDamage->getDamagedPixels();
+        damagedPixels += sceneDamage;
 #if !CONFIG_JAVASCRIPT_ENABLE
         auto now = timeNow(8);
         int min = (now % 3600) / 60.0;
@@ -323,7 +439,16 @@ extern "C" void app_main(void)
         m1Img->setFrame(min % 10);
 #endif
         lv_timer_handler();
-        lv_obj_invalidate(backBufferObj);
-        vTaskDelay(pdMS_TO_TICKS(10));
+        // a changing scene, the engine idle animation too, keeps the active rate, only a static one drops
+        return active || sceneDamage > 0 || bigMouth->getState() != Idle || lv_anim_count_running() > 0 ||
+            lv_disp_get_inactive_time(nullptr) < RENDER_TOUCH_HOLD_MS;
+    };
+    TaskHandle_t renderTaskHandle = nullptr;
+    xTaskCreatePinnedToCore(render_task, "render", 1024 * 8, nullptr, 2, &renderTaskHandle, CONFIG_RENDER_TASK_CORE);
+    bigMouth->setForegroundTaskHandle(renderTaskHandle);
+    // the render task owns lvgl and the scene from here on, this task only follows the ai state
+    while (1)
+    {
+        bigMouth->loop();
     }
 }
\ No newline at end of file
@@ -13,10 +13,17 @@
 #include "ble_op_desc.h"
 #include "cubicat_spine.h"
 #include "esp_timer.h"
+#include "utils/helper.h"
 #include "../rpc/msg.pb-c.h"
 
 #define BUFF_SIZE 1024 * 4
 #define LOAD_TASK_EVENT 1
+// a scene or role load alone takes longer, then only that one runs this frame
+#define LOAD_TASK_BUDGET_US 5000
+// wall clock before this is not synced yet, saved due times can't be compared
+#define REMINDER_MIN_EPOCH 1700000000
+// sntp is started by cubicat without a sync callback here, so the clock is polled
+#define REMINDER_CLOCK_POLL_MS 2000
 extern uint32_t g_bgNodeId;
 extern uint32_t g_clockNodeId;
 int roleIndex = 0;
@@ -25,34 +32,52 @@ MCPServer::MCPServer()
 {
     m_pBuffer = (char*)psram_prefered_malloc(BUFF_SIZE);
     m_eventGroup = xEventGroupCreate();
-    m_taskLock = xSemaphoreCreateBinary();
-    xSemaphoreGive(m_taskLock);
     initTools();
+    loadReminders();
+    m_clockPollTimer = TimerWheel::shared().schedule(REMINDER_CLOCK_POLL_MS, [this]() {
+        restoreReminders();
+    }, REMINDER_CLOCK_POLL_MS);
 }
 
 MCPServer::~MCPServer()
 {
+    {
+        std::lock_guard<std::mutex> lock(m_reminderMutex);
+        if (m_clockPollTimer) {
+            TimerWheel::shared().cancel(m_clockPollTimer);
+        }
+        for (auto& pending : m_reminders) {
+            if (pending.timer) {
+                TimerWheel::shared().cancel(pending.timer);
+            }
+        }
+    }
     free(m_pBuffer);
     vEventGroupDelete(m_eventGroup);
-    vSemaphoreDelete(m_taskLock);
 }
 
-void MCPServer::loop() {
+bool MCPServer::loop() {
     auto bits = xEventGroupWaitBits(m_eventGroup, LOAD_TASK_EVENT, pdTRUE, pdTRUE, 0);
     if (bits & LOAD_TASK_EVENT) {
-        xSemaphoreTake(m_taskLock, portMAX_DELAY);
-        auto task = m_mainThreadTasks.front();
-        m_mainThreadTasks.pop_front();
-        xSemaphoreGive(m_taskLock);
-        task();
+        if (m_mainThreadTasks.drain(LOAD_TASK_BUDGET_US)) {
+            xEventGroupSetBits(m_eventGroup, LOAD_TASK_EVENT);
+        }
+        return true;
     }
+    return false;
 }
 
-void MCPServer::foregroundTask(std::function<void()> callback) {
-    xSemaphoreTake(m_taskLock, portMAX_DELAY);
-    m_mainThreadTasks.push_back(callback);
+void MCPServer::setSocket(ProtoSocket* pSocket) {
+    m_pSocket = pSocket;
+    restoreReminders();
+}
+
+void MCPServer::foregroundTask(TaskFunction callback, TaskPriority priority) {
+    m_mainThreadTasks.post(std::move(callback), priority);
     xEventGroupSetBits(m_eventGroup, LOAD_TASK_EVENT);
-    xSemaphoreGive(m_taskLock);
+    if (m_foregroundTaskHandle) {
+        xTaskNotifyGive(m_foregroundTaskHandle);
+    }
 }
 
 MCPToolPtr MCPServer::getTool(const std::string& name) {
@@ -311,6 +336,7 @@ void MCPServer::roleAction(const char* action) {
 }
 
 void MCPServer::changeRole() {
+    // skeleton load blocks the frame, lighter tasks go first
     foregroundTask([]() {
         auto role = CUBICAT.engine.getSceneManager()->getObjectByName("girl")->cast<SpineNode>();
         if (roleIndex % 2 == 0) {
@@ -323,44 +349,128 @@ void MCPServer::changeRole() {
         role->setAnimation(0, "idle", true);
         role->setZ(-100);
         roleIndex++;
-    });
+    }, TASK_PRIORITY_LOW);
 }
 
-struct RemainderParam
-{
-    std::string         content;
-    esp_timer_handle_t  timerHandle;
-    MCPServer*          mcpServer;
-};
+void MCPServer::remainder(uint32_t time, std::string content) {
+    uint32_t now = timeNow();
+    std::lock_guard<std::mutex> lock(m_reminderMutex);
+    if (m_reminders.size() >= REMINDER_MAX_COUNT) {
+        printf("too many reminders: %zu\n", m_reminders.size());
+        return;
+    }
+    PendingReminder pending = {++m_nReminderSeq, {}, 0, 0};
+    // the wheel runs on the monotonic clock, only the saved due time needs a synced one
+    pending.reminder.due = m_bClockSynced ? now + time : 0;
+    pending.reminder.content = ReminderStore::truncate(content);
+    if (!scheduleReminder(pending, time)) {
+        return;
+    }
+    m_reminders.push_back(std::move(pending));
+    saveReminders();
+}
 
+void MCPServer::loadReminders() {
+    std::vector<Reminder> reminders;
+    ReminderStore::load(reminders);
+    std::lock_guard<std::mutex> lock(m_reminderMutex);
+    // kept unscheduled until the clock is synced, saving before that keeps them
+    for (auto& reminder : reminders) {
+        m_reminders.push_back({++m_nReminderSeq, std::move(reminder), 0, 0});
+    }
+    if (!m_reminders.empty()) {
+        printf("saved reminders: %zu\n", m_reminders.size());
+    }
+}
 
-void MCPServer::remainder(uint32_t time, std::string content) {
-    const esp_timer_create_args_t args = {
-        .callback = [](void* arg) {
-            auto param = (RemainderParam*)arg;
-            esp_timer_delete(param->timerHandle);
-            std::string prompt = "不调用工具,直接提醒我" + param->content + "时间到了,必须加上具体提醒内容";
-            param->mcpServer->sendTextChat(prompt);
-            printf("remainder: %s\n", prompt.c_str());
-            delete param;
-        },
-        .arg = new RemainderParam(content, nullptr, this),
-        .dispatch_method = ESP_TIMER_TASK,
-        .name = "remainder",
-        .skip_unhandled_events = true
-    };
-    auto err = esp_timer_create(&args, &((RemainderParam*)args.arg)->timerHandle);
-    if (err != ESP_OK) {
-        printf("create timer failed : %d\n", err);
-        delete ((RemainderParam*)args.arg);
+bool MCPServer::scheduleReminder(PendingReminder& pending, uint32_t delaySeconds) {
+    uint32_t seq = pending.seq;
+    // fires on the timer worker, sendTextChat may reconnect and sleep there
+    auto timer = TimerWheel::shared().schedule(delaySeconds * 1000, [this, seq]() {
+        fireReminder(seq);
+    });
+    if (!timer) {
+        return false;
+    }
+    pending.timer = timer;
+    pending.deadlineUs = esp_timer_get_time() + (int64_t)delaySeconds * 1000000;
+    return true;
+}
+
+void MCPServer::saveReminders() {
+    std::vector<Reminder> reminders;
+    reminders.reserve(m_reminders.size());
+    for (auto& pending : m_reminders) {
+        // set before the clock synced, saved once its due time is known
+        if (pending.reminder.due) {
+            reminders.push_back(pending.reminder);
+        }
+    }
+    ReminderStore::save(reminders);
+}
+
+void MCPServer::restoreReminders() {
+    uint32_t now = timeNow();
+    if (now < REMINDER_MIN_EPOCH) {
+        // tried again by the clock poll timer and on the next connect
         return;
     }
-    err = esp_timer_start_once(((RemainderParam*)args.arg)->timerHandle, time * 1000 * 1000);
-    if (err != ESP_OK) {
-        printf("start timer failed : %d\n", err);
-        delete ((RemainderParam*)args.arg);
+    std::lock_guard<std::mutex> lock(m_reminderMutex);
+    if (m_bClockSynced) {
         return;
     }
+    m_bClockSynced = true;
+    if (m_clockPollTimer) {
+        TimerWheel::shared().cancel(m_clockPollTimer);
+        m_clockPollTimer = 0;
+    }
+    int64_t nowUs = esp_timer_get_time();
+    size_t restored = 0;
+    auto it = m_reminders.begin();
+    while (it != m_reminders.end()) {
+        Reminder& reminder = it->reminder;
+        if (it->timer) {
+            // set while unsynced and already running, only its due time is filled in
+            if (!reminder.due) {
+                int64_t leftUs = it->deadlineUs - nowUs;
+                reminder.due = now + (leftUs > 0 ? (uint32_t)(leftUs / 1000000) : 0);
+            }
+            it++;
+            continue;
+        }
+        // missed while powered off, reminded right away
+        if (!scheduleReminder(*it, reminder.due > now ? reminder.due - now : 0)) {
+            printf("restore reminder failed: %s\n", reminder.content.c_str());
+            it = m_reminders.erase(it);
+            continue;
+        }
+        restored++;
+        it++;
+    }
+    saveReminders();
+    if (restored) {
+        printf("restored reminders: %zu\n", restored);
+    }
+}
+
+void MCPServer::fireReminder(uint32_t seq) {
+    std::string content;
+    {
+        std::lock_guard<std::mutex> lock(m_reminderMutex);
+        auto it = m_reminders.begin();
+        while (it != m_reminders.end() && it->seq != seq) {
+            it++;
+        }
+        if (it == m_reminders.end()) {
+            return;
+        }
+        content = std::move(it->reminder.content);
+        m_reminders.erase(it);
+        saveReminders();
+    }
+    std::string prompt = "不调用工具,直接提醒我" + content + "时间到了,必须加上具体提醒内容";
+    sendTextChat(prompt);
+    printf("remainder: %s\n", prompt.c_str());
 }
 
 void MCPServer::sendTextChat(const std::string& chat) {
@@ -374,7 +484,7 @@ void MCPServer::sendTextChat(const std::string& chat) {
         vTaskDelay(1000 / portTICK_PERIOD_MS);
     }
     if (m_pSocket->isConnected()) {
-        m_pSocket->send("jsonMessage", &msg);
+        m_pSocket->send("jsonMessage", &msg, TX_LANE_BULK);
     }
 }
 void MCPServer::changeScene(const std::string& roomName) {
@@ -385,7 +495,7 @@ void MCPServer::changeScene(const std::string& roomName) {
         auto sceneTex = resMgr->loadTexture(texName);
         auto sceneNode = sceneMgr->getObjectById(g_bgNodeId);
         sceneNode->getDrawable(0)->getMaterial()->setTexture(sceneTex);
-    });
+    }, TASK_PRIORITY_LOW);
 }
 void MCPServer::showClock(bool show) {
     foregroundTask([show]() {
@@ -11,10 +11,13 @@
 #include <string>
 #include "cubicat.h"
 #include <functional>
-#include <list>
 #include <unordered_map>
+#include <mutex>
 #include "mcp_tool.h"
 #include "proto_socket.h"
+#include "task_executor.h"
+#include "timer_wheel.h"
+#include "reminder_store.h"
 
 using namespace cubicat;
 
@@ -30,16 +33,20 @@ public:
         return tool;
     }
     std::string eval(cJSON* call);
-    void setSocket(ProtoSocket* pSocket) { m_pSocket = pSocket; }
-    // Main thread loop
-    void loop();
+    // also schedules the saved reminders if the clock is synced by now
+    void setSocket(ProtoSocket* pSocket);
+    // Render task, once per frame. true if a task ran
+    bool loop();
+    // notified when a task is posted
+    void setForegroundTaskHandle(TaskHandle_t handle) { m_foregroundTaskHandle = handle; }
+    void logTaskStats() const { m_mainThreadTasks.logStats(); }
 private:
-    SemaphoreHandle_t                   m_taskLock = nullptr;
     EventGroupHandle_t                  m_eventGroup = nullptr;
-    std::list<std::function<void()>>    m_mainThreadTasks;
+    TaskHandle_t                        m_foregroundTaskHandle = nullptr;
+    TaskExecutor                        m_mainThreadTasks{"mcp"};
 
     std::string getToolListJson(const char* id);
-    void foregroundTask(std::function<void()> callback);
+    void foregroundTask(TaskFunction callback, TaskPriority priority = TASK_PRIORITY_NORMAL);
     MCPToolPtr getTool(const std::string& name);
     void initTools();
 
@@ -50,6 +57,22 @@ private:
     void changeRole();
     void roleAction(const char* action);
     void remainder(uint32_t timestamp, std::string content);
+    struct PendingReminder {
+        uint32_t    seq;
+        Reminder    reminder;
+        // 0 until scheduled on the wheel
+        TimerId     timer;
+        // esp_timer time the wheel fires it
+        int64_t     deadlineUs;
+    };
+    void loadReminders();
+    // m_reminderMutex held
+    bool scheduleReminder(PendingReminder& pending, uint32_t delaySeconds);
+    void saveReminders();
+    // once the wall clock is synced, from setSocket or the clock poll timer
+    void restoreReminders();
+    // timer worker task
+    void fireReminder(uint32_t seq);
     void sendTextChat(const std::string& chat);
     void changeScene(const std::string& sceneName);
     void showClock(bool show);
@@ -57,6 +80,11 @@ private:
     // Response buffer
     char*                               m_pBuffer;
     std::vector<MCPToolPtr>             m_toolsList;
+    std::mutex                          m_reminderMutex;
+    std::vector<PendingReminder>        m_reminders;
+    uint32_t                            m_nReminderSeq = 0;
+    bool                                m_bClockSynced = false;
+    TimerId                             m_clockPollTimer = 0;
     
 };
 
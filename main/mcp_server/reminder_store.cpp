@@ -0,0 +1,92 @@
+#include "reminder_store.h"
+#include "nvs.h"
+#include "utils/logger.h"
+
+#define REMINDER_NAMESPACE "reminders"
+#define REMINDER_KEY "pending"
+#define REMINDER_VERSION 1
+
+bool ReminderStore::load(std::vector<Reminder>& reminders) {
+    reminders.clear();
+    nvs_handle_t handle;
+    if (nvs_open(REMINDER_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        // nothing saved yet
+        return true;
+    }
+    size_t len = 0;
+    auto err = nvs_get_blob(handle, REMINDER_KEY, nullptr, &len);
+    if (err != ESP_OK || len == 0) {
+        nvs_close(handle);
+        return err == ESP_ERR_NVS_NOT_FOUND;
+    }
+    std::vector<uint8_t> blob(len);
+    err = nvs_get_blob(handle, REMINDER_KEY, blob.data(), &len);
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        LOGE("load reminders failed: %d\n", err);
+        return false;
+    }
+    if (blob[0] != REMINDER_VERSION) {
+        LOGW("unknown reminder version: %d\n", blob[0]);
+        return false;
+    }
+    size_t pos = 1;
+    while (pos + 5 <= len && reminders.size() < REMINDER_MAX_COUNT) {
+        Reminder reminder;
+        reminder.due = blob[pos] | (blob[pos + 1] << 8) | (blob[pos + 2] << 16) | ((uint32_t)blob[pos + 3] << 24);
+        uint8_t contentLen = blob[pos + 4];
+        pos += 5;
+        if (pos + contentLen > len) {
+            LOGW("reminder blob truncated\n");
+            break;
+        }
+        reminder.content.assign((const char*)blob.data() + pos, contentLen);
+        pos += contentLen;
+        reminders.push_back(std::move(reminder));
+    }
+    return true;
+}
+
+bool ReminderStore::save(const std::vector<Reminder>& reminders) {
+    std::vector<uint8_t> blob;
+    blob.reserve(1 + reminders.size() * (5 + REMINDER_MAX_CONTENT));
+    blob.push_back(REMINDER_VERSION);
+    for (auto& reminder : reminders) {
+        std::string content = truncate(reminder.content);
+        blob.push_back(reminder.due & 0xFF);
+        blob.push_back((reminder.due >> 8) & 0xFF);
+        blob.push_back((reminder.due >> 16) & 0xFF);
+        blob.push_back((reminder.due >> 24) & 0xFF);
+        blob.push_back(content.size());
+        blob.insert(blob.end(), content.begin(), content.end());
+    }
+    nvs_handle_t handle;
+    auto err = nvs_open(REMINDER_NAMESPACE, NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        LOGE("open reminder storage failed: %d\n", err);
+        return false;
+    }
+    // an empty list is just the version byte, cheaper than erasing the key
+    err = nvs_set_blob(handle, REMINDER_KEY, blob.data(), blob.size());
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+    nvs_close(handle);
+    if (err != ESP_OK) {
+        LOGE("save reminders failed: %d\n", err);
+        return false;
+    }
+    return true;
+}
+
+std::string ReminderStore::truncate(const std::string& content) {
+    if (content.size() <= REMINDER_MAX_CONTENT) {
+        return content;
+    }
+    size_t len = REMINDER_MAX_CONTENT;
+    // back off continuation bytes so the cut lands before a lead byte
+    while (len > 0 && ((uint8_t)content[len] & 0xC0) == 0x80) {
+        len--;
+    }
+    return content.substr(0, len);
+}
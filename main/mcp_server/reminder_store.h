@@ -0,0 +1,28 @@
+#ifndef _REMINDER_STORE_H_
+#define _REMINDER_STORE_H_
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#define REMINDER_MAX_COUNT 16
+// utf8 content is cut on a character boundary
+#define REMINDER_MAX_CONTENT 120
+
+struct Reminder {
+    // unix time in seconds
+    uint32_t    due = 0;
+    std::string content;
+};
+
+// Pending reminders kept in NVS across reboots.
+// All reminders are one blob: version byte, then per reminder
+// due (4 bytes little endian) | content length (1 byte) | content
+class ReminderStore {
+public:
+    static bool load(std::vector<Reminder>& reminders);
+    static bool save(const std::vector<Reminder>& reminders);
+    // content cut to REMINDER_MAX_CONTENT bytes without splitting a character
+    static std::string truncate(const std::string& content);
+};
+
+#endif
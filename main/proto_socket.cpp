@@ -1,101 +1,386 @@
 #include "proto_socket.h"
 #include "utils/logger.h"
 #include <arpa/inet.h>
-#include "socket/compress.h"
+#include <string.h>
 #include "core/memory_allocator.h"
 #include "utils/helper.h"
+#include "esp_timer.h"
 
-#define MAX_RECV_BUFF_SIZE 1024 * 32
-// data in big endian
-#define READ_PROTOCOL_LEN(data) \
-        (static_cast<int>(data[0]) << 24) | \
-        (static_cast<int>(data[1]) << 16) | \
-        (static_cast<int>(data[2]) << 8)  | \
-        (static_cast<int>(data[3]));
-
-#define IMPLEMENTSENDMESSAGE(MSG,pre_fix) \
-void ProtoSocket::send(const char* method,Rpc__##MSG* msg) { \
+#define IMPLEMENTSENDMESSAGE(MSG,codec,droppable) \
+void ProtoSocket::send(const char* method,Rpc__##MSG* msg, TxLane lane) { \
     if (!isConnected()) \
         return; \
-    Rpc__Request req = RPC__REQUEST__INIT; \
-    req.method = (char*)method; \
-    req.protoname = (char*)#MSG; \
-    auto size = pre_fix##__get_packed_size(msg); \
-    uint8_t* msgBuffer = nullptr; \
-    if (size > 0) { \
-        msgBuffer = (uint8_t*)malloc(size); \
-        size = pre_fix##__pack(msg, msgBuffer); \
-    } \
-    req.serialized_data.len = size; \
-    req.serialized_data.data = msgBuffer; \
-    auto _size = rpc__request__get_packed_size(&req); \
-    uint8_t* reqBuffer = (uint8_t*)malloc(_size); \
-    _size = rpc__request__pack(&req, reqBuffer); \
-    assert(_size > 0); \
-    size_t compressed_len = 0; \
-    auto compressed_data = defl(reqBuffer, _size, &compressed_len, Z_BEST_SPEED); \
-    if (compressed_data) { \
-        int ret = send((const char*)compressed_data, compressed_len, true); \
-        free(compressed_data); \
-    } else { \
-        LOGE("compress error\n"); \
-    } \
-    if (msgBuffer) \
-        free(msgBuffer); \
-    free(reqBuffer); \
+    sendMessage(method, #MSG, RPC_MSG_ID_##MSG, &msg->base, codec, lane, droppable); \
+}
+
+#define SENDER_BATCH_WAIT_MS 1000
+
+static uint8_t rpcMethodId(const char* method) {
+#define RPC_METHOD_MATCH(name, id) if (strcmp(method, #name) == 0) return id;
+    RPC_METHOD_LIST(RPC_METHOD_MATCH)
+#undef RPC_METHOD_MATCH
+    return 0;
+}
+
+// Inner message is not packed on its own, the envelope's serialized_data points to
+// this placeholder and the sink packs the inner message right where its bytes belong.
+static const uint8_t s_innerMessagePlaceholder = 0;
+
+struct PackSink {
+    ProtobufCBuffer             base;
+    uint8_t*                    cursor;
+    const ProtobufCMessage*     inner;
+};
+
+static void packSinkAppend(ProtobufCBuffer* buffer, size_t len, const uint8_t* data) {
+    auto sink = (PackSink*)buffer;
+    if (data == &s_innerMessagePlaceholder) {
+        protobuf_c_message_pack(sink->inner, sink->cursor);
+    } else if (len) {
+        memcpy(sink->cursor, data, len);
+    }
+    sink->cursor += len;
 }
+
 ProtoSocket::ProtoSocket() {
-    m_pDataBuffer = (uint8_t*)psram_malloc(MAX_RECV_BUFF_SIZE);
-    assert(m_pDataBuffer);
 }
 ProtoSocket::~ProtoSocket() {
-    if (m_pDataBuffer) {
-        free(m_pDataBuffer);
+    if (m_pPackBuffer) {
+        free(m_pPackBuffer);
+        m_pPackBuffer = nullptr;
     }
 }
+void ProtoSocket::onConnected() {
+    // framing was put back to v1 on disconnect, before the recv thread of this connection started
+    startSender();
+    TcpSocket::onConnected();
+    // ask for framing v2 and msg id mode, old servers just ignore it and we stay on v1
+    char version[4];
+    snprintf(version, sizeof(version), "%d", FRAMING_V2);
+    Rpc__KeyValue framing = RPC__KEY_VALUE__INIT;
+    framing.key = (char*)FRAMING_CONFIG_KEY;
+    framing.value = version;
+    Rpc__KeyValue msgId = RPC__KEY_VALUE__INIT;
+    msgId.key = (char*)MSG_ID_CONFIG_KEY;
+    msgId.value = (char*)"1";
+    Rpc__KeyValue* pairs[] = {&framing, &msgId};
+    Rpc__Configs configs = RPC__CONFIGS__INIT;
+    configs.n_pairs = 2;
+    configs.pairs = pairs;
+    send("configs", &configs);
+}
 void ProtoSocket::ping() {
-    Rpc__Ping ping = RPC__PING__INIT;
-    send("ping", &ping);
+    if (!isConnected()) {
+        return;
+    }
+    // stamped before queuing, the pong can't beat it. a ping still unanswered keeps its
+    // send time, rtt then includes the wait
+    int64_t now = esp_timer_get_time();
+    int64_t pending = 0;
+    bool stamped = m_pingSentTime.compare_exchange_strong(pending, now);
+    bool queued = false;
+    if (m_framingVersion >= FRAMING_V2) {
+        // zero length heartbeat frame, nothing to pack or compress
+        TxPacket* packet = m_txQueue.acquire(TX_LANE_CONTROL, FRAME_LEN_PREFIX_SIZE, false);
+        if (packet) {
+            memset(packet->buffer, 0, FRAME_LEN_PREFIX_SIZE);
+            packet->len = FRAME_LEN_PREFIX_SIZE;
+            packet->framing = FRAMING_V2;
+            m_txQueue.commit(packet);
+            queued = true;
+        }
+    } else {
+        Rpc__Ping ping = RPC__PING__INIT;
+        queued = sendMessage("ping", "Ping", RPC_MSG_ID_Ping, &ping.base, FRAME_CODEC_NONE, TX_LANE_CONTROL, false);
+    }
+    if (stamped && !queued) {
+        // nothing went out, a later pong must not be measured against this ping
+        m_pingSentTime.compare_exchange_strong(now, 0);
+    }
 }
-void ProtoSocket::onDataReceived(uint8_t* data, size_t len) {
-    memcpy(m_pDataBuffer + m_nDataLen, data, len);
-    m_nDataLen += len;
-    assert(m_nDataLen <= MAX_RECV_BUFF_SIZE);
-    if (m_nDataLen <= 4) {
+SendStats ProtoSocket::getSendStats() {
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return m_sendStats;
+}
+void ProtoSocket::logStats() {
+    SendStats send = getSendStats();
+    TxStats tx = getTxStats();
+    // pack, compress and memcpy bytes per byte written to lwip, what the single copy path keeps low
+    float copiesPerByte = send.bytesSent ? (float)send.bytesCopied / send.bytesSent : 0;
+    LOGI("tx messages: %u sent: %llu bytes copied: %llu bytes (%.2f per sent byte) batches: %u latency avg: %uus max: %uus\n",
+        send.messages, (unsigned long long)send.bytesSent, (unsigned long long)send.bytesCopied, copiesPerByte,
+        tx.batches, tx.avgLatency, tx.maxLatency);
+    for (int i = 0; i < TX_LANE_COUNT; i++) {
+        auto& lane = tx.lanes[i];
+        LOGI("tx lane %d queued: %u sent: %u dropped full: %u stale: %u depth: %u max: %u\n",
+            i, lane.queued, lane.sent, lane.droppedFull, lane.droppedStale, lane.depth, lane.maxDepth);
+    }
+    // what the arena block size is tuned against, written by the recv thread, fine for a log line
+    LOGI("recv arena peak: %zu block: %zu\n", m_recvArena.getPeak(), m_recvArena.getBlockSize());
+}
+bool ProtoSocket::sendMessage(const char* method, const char* protoname, uint16_t msgId, const ProtobufCMessage* msg,
+                              uint8_t codec, TxLane lane, bool droppable) {
+    uint8_t version = m_framingVersion;
+    uint8_t methodId = 0;
+    if (version >= FRAMING_V2 && m_bMsgIdMode) {
+        // unknown methods keep the string form
+        methodId = rpcMethodId(method);
+    }
+    Rpc__Request req = RPC__REQUEST__INIT;
+    req.method = (char*)(methodId ? "" : method);
+    req.protoname = (char*)(methodId ? "" : protoname);
+    req.serialized_data.len = protobuf_c_message_get_packed_size(msg);
+    req.serialized_data.data = (uint8_t*)&s_innerMessagePlaceholder;
+    size_t size = rpc__request__get_packed_size(&req);
+    if (version < FRAMING_V2) {
+        // v1 frames are always compressed
+        codec = FRAME_CODEC_ZLIB;
+    }
+    // may wait for the sender when the lane is full, never for the network
+    TxPacket* packet = m_txQueue.acquire(lane, FRAME_HEAD_ROOM + size, droppable);
+    if (!packet) {
+        LOGW("tx lane %d full, drop %s\n", lane, protoname);
+        return false;
+    }
+    PackSink sink;
+    sink.base.append = packSinkAppend;
+    sink.inner = msg;
+    if (codec == FRAME_CODEC_ZLIB) {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        if (size > m_nPackBufferSize) {
+            uint8_t* buffer = nullptr;
+            if (m_pPackBuffer)
+                buffer = (uint8_t*)psram_prefered_realloc(m_pPackBuffer, size);
+            else
+                buffer = (uint8_t*)psram_prefered_malloc(size);
+            if (!buffer) {
+                LOGE("malloc failed not enough memory:%zu\n", size);
+                m_txQueue.release(packet);
+                return false;
+            }
+            m_pPackBuffer = buffer;
+            m_nPackBufferSize = size;
+        }
+        sink.cursor = m_pPackBuffer;
+        protobuf_c_message_pack_to_buffer(&req.base, &sink.base);
+        size = sink.cursor - m_pPackBuffer;
+        m_sendStats.bytesCopied += size;
+        // compress straight into the queued packet
+        size_t bound = m_codec.compressBound(size);
+        if (!bound || !m_txQueue.reserve(packet, FRAME_HEAD_ROOM + bound) ||
+            !m_codec.compress(m_pPackBuffer, size, packet->buffer + FRAME_HEAD_ROOM, bound, &size)) {
+            LOGE("compress error\n");
+            m_txQueue.release(packet);
+            return false;
+        }
+        m_sendStats.bytesCopied += size;
+    } else {
+        sink.cursor = packet->buffer + FRAME_HEAD_ROOM;
+        protobuf_c_message_pack_to_buffer(&req.base, &sink.base);
+        size = sink.cursor - (packet->buffer + FRAME_HEAD_ROOM);
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sendStats.bytesCopied += size;
+    }
+    finishFrame(packet, size, version, codec, msgId, methodId);
+    m_txQueue.commit(packet);
+    return true;
+}
+void ProtoSocket::finishFrame(TxPacket* packet, size_t len, uint8_t version, uint8_t codec, uint16_t msgId, uint8_t methodId) {
+    // header is written backwards from the payload
+    uint8_t* payload = packet->buffer + FRAME_HEAD_ROOM;
+    uint8_t* head = payload;
+    if (version >= FRAMING_V2) {
+        uint8_t flags = codec & FRAME_FLAG_CODEC_MASK;
+        if (methodId) {
+            flags |= FRAME_FLAG_MSG_ID;
+            *--head = methodId;
+            *--head = msgId & 0xff;
+            *--head = msgId >> 8;
+        }
+        *--head = flags;
+    }
+    uint32_t bigEndianSize = htonl(payload + len - head);
+    head -= FRAME_LEN_PREFIX_SIZE;
+    memcpy(head, &bigEndianSize, FRAME_LEN_PREFIX_SIZE);
+    packet->data = head;
+    packet->len = payload + len - head;
+    packet->framing = version >= FRAMING_V2 ? FRAMING_V2 : FRAMING_V1;
+}
+void ProtoSocket::reframe(TxPacket* packet) {
+    // a v1 payload is always zlib and starts right after the length prefix, at FRAME_HEAD_ROOM
+    finishFrame(packet, packet->len - FRAME_LEN_PREFIX_SIZE, FRAMING_V2, FRAME_CODEC_ZLIB, RPC_MSG_ID_None, 0);
+}
+void ProtoSocket::startSender() {
+    if (m_senderHandle) {
         return;
     }
-    size_t protocolLen = READ_PROTOCOL_LEN(m_pDataBuffer);
-    size_t packetLen = protocolLen + 4;
-    while (m_nDataLen >= packetLen) {
+    xTaskCreatePinnedToCore([](void* arg) {
+        ((ProtoSocket*)arg)->senderLoop();
+    }, "tcp send task", 1024 * 4, this, 2, &m_senderHandle, getSubCoreId());
+}
+void ProtoSocket::senderLoop() {
+    TxPacket* batch[TCP_SEND_BATCH_MAX];
+    const uint8_t* packets[TCP_SEND_BATCH_MAX];
+    size_t lens[TCP_SEND_BATCH_MAX];
+    while (true) {
+        size_t count = m_txQueue.popBatch(batch, TCP_SEND_BATCH_MAX, SENDER_BATCH_WAIT_MS);
+        if (!count) {
+            continue;
+        }
+        int ret = -1;
+        if (isConnected()) {
+            // packed before the server switched us to v2, the server parses v2 only from now on
+            uint8_t version = m_framingVersion;
+            size_t reframed = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (batch[i]->framing < version) {
+                    reframe(batch[i]);
+                    reframed++;
+                }
+            }
+            if (reframed) {
+                LOGI("reframed %zu queued v1 packets\n", reframed);
+            }
+            // whatever is ready goes out in one syscall, lanes are already in priority order
+            for (size_t i = 0; i < count; i++) {
+                packets[i] = batch[i]->data;
+                lens[i] = batch[i]->len;
+            }
+            ret = sendBatch(packets, lens, count);
+        }
+        if (ret > 0) {
+            std::lock_guard<std::mutex> lock(m_sendMutex);
+            m_sendStats.messages += count;
+            m_sendStats.bytesSent += ret;
+        }
+        m_txQueue.recycle(batch, count, ret > 0);
+    }
+}
+void ProtoSocket::onDataReceived(uint8_t* data, size_t len) {
+    bool ok = m_frameReassembler.feed(data, len, [this](const uint8_t* frame, size_t frameLen) {
+        onFrame(frame, frameLen);
+    });
+    if (!ok) {
+        LOGE("corrupted stream, drop connection\n");
+        m_frameReassembler.reset();
+        disconnect();
+    }
+}
+void ProtoSocket::onDisconnected() {
+    // partial frame of the old connection is useless, so is anything still queued for it
+    m_frameReassembler.reset();
+    m_txQueue.clear();
+    m_pingSentTime = 0;
+    // the recv thread of the next connection may start before onConnected, it must read v1 already
+    m_framingVersion = FRAMING_V1;
+    m_recvFramingVersion = FRAMING_V1;
+    m_bMsgIdMode = false;
+    TcpSocket::onDisconnected();
+}
+void ProtoSocket::onFrame(const uint8_t* data, size_t len) {
+    uint8_t codec = FRAME_CODEC_ZLIB;
+    uint16_t msgId = RPC_MSG_ID_None;
+    if (m_recvFramingVersion >= FRAMING_V2) {
+        if (len == 0) {
+            // heartbeat
+            onPong();
+            return;
+        }
+        uint8_t flags = data[0];
+        codec = flags & FRAME_FLAG_CODEC_MASK;
+        data++;
+        len--;
+        if (flags & FRAME_FLAG_MSG_ID) {
+            if (len < FRAME_MSG_ID_SIZE) {
+                LOGE("truncated frame header\n");
+                return;
+            }
+            // method id is only meaningful for the server
+            msgId = (data[0] << 8) | data[1];
+            data += FRAME_MSG_ID_SIZE;
+            len -= FRAME_MSG_ID_SIZE;
+        }
+    }
+    if (codec == FRAME_CODEC_ZLIB) {
         // decompress data
-        // jump over 4 bytes
-        uint8_t* protocolData = m_pDataBuffer + 4;
         size_t decompressedLen = 0;
-        uint8_t* decompressedData = infl(protocolData, protocolLen, &decompressedLen);
-        if(!decompressedData) {
-            assert(false);
-            break;
+        data = m_codec.decompress(data, len, &decompressedLen);
+        if(!data) {
+            LOGE("decompress error\n");
+            return;
+        }
+        len = decompressedLen;
+    } else if (codec != FRAME_CODEC_NONE) {
+        LOGE("unsupported frame codec: %d\n", codec);
+        return;
+    }
+    onPayload(data, len, msgId);
+}
+void ProtoSocket::onPayload(const uint8_t* data, size_t len, uint16_t msgId) {
+    // request and inner messages unpacked by handlers are all released at once when scope ends
+    MessageArena::Scope scope(&m_recvArena);
+    auto allocator = m_recvArena.getProtobufAllocator();
+    Rpc__Request* req = rpc__request__unpack(allocator, len, data); 
+    if (req) {
+        m_timeDiff = req->servertime - timeNow();
+        if (msgId == RPC_MSG_ID_None) {
+            msgId = rpcMsgIdFromName(req->protoname);
+        }
+        if (msgId == RPC_MSG_ID_Ping) {
+            onPong();
+        }
+        if (!handleTransportConfig(req, msgId) && m_pListener) {
+            ((ProtoSocketListener*)m_pListener)->onRequest(req, msgId);
+        }
+        rpc__request__free_unpacked(req, allocator);
+    }
+}
+void ProtoSocket::onPong() {
+    int64_t sent = m_pingSentTime.exchange(0);
+    if (sent) {
+        m_nRttUs = esp_timer_get_time() - sent;
+    }
+}
+bool ProtoSocket::handleTransportConfig(Rpc__Request* req, uint16_t msgId) {
+    if (msgId != RPC_MSG_ID_Configs) {
+        return false;
+    }
+    auto configs = rpc__configs__unpack(MessageArena::currentAllocator(), req->serialized_data.len, req->serialized_data.data);
+    if (!configs) {
+        return false;
+    }
+    size_t handled = 0;
+    for (size_t i = 0; i < configs->n_pairs; i++) {
+        auto pair = configs->pairs[i];
+        if (!pair->key || !pair->value) {
+            continue;
         }
-        Rpc__Request* req = rpc__request__unpack(nullptr, decompressedLen, decompressedData); 
-        free(decompressedData);
-        if (req) {
-            m_timeDiff = req->servertime - timeNow();
-            if (m_pListener) {
-                ((ProtoSocketListener*)m_pListener)->onRequest(req);
+        // server switches right after this message, so do we. v1 packets already
+        // queued are re-framed by the sender, a connection never goes back to v1
+        if (strcmp(pair->key, FRAMING_CONFIG_KEY) == 0) {
+            if (atoi(pair->value) >= FRAMING_V2) {
+                m_recvFramingVersion = FRAMING_V2;
+                m_framingVersion = FRAMING_V2;
             }
-            rpc__request__free_unpacked(req, nullptr);
+            LOGI("framing version: %d\n", m_framingVersion.load());
+            handled++;
+        } else if (strcmp(pair->key, MSG_ID_CONFIG_KEY) == 0) {
+            m_bMsgIdMode = atoi(pair->value) == 1;
+            LOGI("msg id mode: %d\n", m_bMsgIdMode.load());
+            handled++;
         }
-        m_nDataLen -= packetLen;
-        memmove(m_pDataBuffer, m_pDataBuffer + packetLen, m_nDataLen);
-        protocolLen = READ_PROTOCOL_LEN(m_pDataBuffer);
-        packetLen = protocolLen + 4;
     }
+    bool consumed = handled > 0 && handled == configs->n_pairs;
+    rpc__configs__free_unpacked(configs, MessageArena::currentAllocator());
+    return consumed;
 }
 
 //**************** Implement send methods begin ***************
-IMPLEMENTSENDMESSAGE(Request, rpc__request)
-IMPLEMENTSENDMESSAGE(Login, rpc__login)
-IMPLEMENTSENDMESSAGE(Msg, rpc__msg)
-IMPLEMENTSENDMESSAGE(Ping, rpc__ping)
-IMPLEMENTSENDMESSAGE(BytesMsg, rpc__bytes_msg)
+IMPLEMENTSENDMESSAGE(Request, FRAME_CODEC_ZLIB, false)
+IMPLEMENTSENDMESSAGE(Login, FRAME_CODEC_ZLIB, false)
+IMPLEMENTSENDMESSAGE(Msg, FRAME_CODEC_ZLIB, false)
+IMPLEMENTSENDMESSAGE(Ping, FRAME_CODEC_NONE, false)
+// opus data does not compress, don't waste cpu on it. late audio frames may be dropped
+IMPLEMENTSENDMESSAGE(BytesMsg, FRAME_CODEC_NONE, true)
+IMPLEMENTSENDMESSAGE(Configs, FRAME_CODEC_ZLIB, false)
 //**************** Implement send methods end   ***************
\ No newline at end of file
@@ -1,15 +1,59 @@
 #ifndef _PROTO_SOCKET_H_
 #define _PROTO_SOCKET_H_
 #include "socket/tcpsocket.h"
+#include "socket/frame_reassembler.h"
+#include "socket/zlib_codec.h"
+#include "socket/message_arena.h"
+#include "socket/tx_queue.h"
 #include "rpc/msg.pb-c.h"
+#include "rpc/msg_ids.h"
+#include <atomic>
 
 
-#define DECLARESENDMESSAGE(MSG) \
-    void send(const char* method, MSG* msg);
+#define DECLARESENDMESSAGE(MSG, LANE) \
+    void send(const char* method, MSG* msg, TxLane lane = LANE);
+
+// Framing v1: length(4 bytes, big endian) | zlib(protobuf)
+// Framing v2: length(4 bytes, big endian) | flags(1 byte) | [msg id(2 bytes) | method id(1 byte)] | body
+//             a zero length frame is a heartbeat and carries no flags
+//             msg id and method id are present when FRAME_FLAG_MSG_ID is set, the envelope's
+//             method and protoname strings are left empty then
+// v2 and msg id mode are requested by the client with a "configs" message right after login,
+// the connection stays on v1 until the server echoes the same key back. Packets still queued
+// as v1 at that point are re-framed as v2 by the sender task before they go out.
+#define FRAMING_V1              1
+#define FRAMING_V2              2
+#define FRAMING_CONFIG_KEY      "framing"
+#define MSG_ID_CONFIG_KEY       "msgid"
+#define FRAME_FLAG_CODEC_MASK   0x03
+#define FRAME_FLAG_MSG_ID       0x04
+#define FRAME_MSG_ID_SIZE       3
+#define FRAME_CODEC_NONE        0x00
+#define FRAME_CODEC_ZLIB        0x01
+// reserved for a lightweight LZ codec, not supported by this client yet
+#define FRAME_CODEC_LZ          0x02
+// room kept in front of every outgoing payload for length prefix, v2 flags and ids
+#define FRAME_HEAD_ROOM         (FRAME_LEN_PREFIX_SIZE + 1 + FRAME_MSG_ID_SIZE)
+
+// rpc methods the client sends, id is what goes on the wire in msg id mode
+#define RPC_METHOD_LIST(X) \
+    X(login, 1) \
+    X(ping, 2) \
+    X(configs, 3) \
+    X(jsonMessage, 4) \
+    X(audioMessage, 5)
+
+struct SendStats {
+    uint32_t    messages = 0;
+    // bytes written by pack/compress/memcpy on the way to lwip
+    uint64_t    bytesCopied = 0;
+    uint64_t    bytesSent = 0;
+};
 
 class ProtoSocketListener : public SocketListener {
 public:
-    virtual void onRequest(Rpc__Request*) = 0;
+    // msgId is one of RpcMsgId, resolved from the frame header or the protoname
+    virtual void onRequest(Rpc__Request*, uint16_t msgId) = 0;
 };
         
 
@@ -17,20 +61,66 @@ class ProtoSocket : public TcpSocket {
 public:
     ProtoSocket();
     ~ProtoSocket();
-    DECLARESENDMESSAGE(Rpc__Request)
-    DECLARESENDMESSAGE(Rpc__Login)
-    DECLARESENDMESSAGE(Rpc__Msg)
-    DECLARESENDMESSAGE(Rpc__Ping)
-    DECLARESENDMESSAGE(Rpc__BytesMsg)
+    // send only packs the message into the tx queue, the sender task writes it to the socket
+    DECLARESENDMESSAGE(Rpc__Request, TX_LANE_CONTROL)
+    DECLARESENDMESSAGE(Rpc__Login, TX_LANE_CONTROL)
+    DECLARESENDMESSAGE(Rpc__Msg, TX_LANE_CONTROL)
+    DECLARESENDMESSAGE(Rpc__Ping, TX_LANE_CONTROL)
+    DECLARESENDMESSAGE(Rpc__BytesMsg, TX_LANE_AUDIO)
+    DECLARESENDMESSAGE(Rpc__Configs, TX_LANE_CONTROL)
 public:
+    void onConnected() override;
     void onDataReceived(uint8_t* data, size_t len) override;
     // 每隔一段时间调用，免得被服务器踢掉
     void ping();
+    uint8_t getFramingVersion() { return m_framingVersion; }
+    bool isMsgIdMode() { return m_bMsgIdMode; }
+    SendStats getSendStats();
+    TxStats getTxStats() { return m_txQueue.getStats(); }
+    // send, tx queue and receive arena totals since boot
+    void logStats();
+    // round trip of the last answered ping in us, 0 before the first answer
+    uint32_t getRtt() { return m_nRttUs; }
+    // queued audio older than this is dropped instead of sent
+    void setAudioDeadline(uint32_t ms) { m_txQueue.setAudioDeadline(ms); }
 private:
     using TcpSocket::send;
-    uint8_t*        m_pDataBuffer = nullptr;
-    uint32_t        m_nDataLen = 0;
+    void onDisconnected() override;
+    void onFrame(const uint8_t* data, size_t len);
+    void onPayload(const uint8_t* data, size_t len, uint16_t msgId);
+    // server answers a ping with a ping, or a heartbeat with a heartbeat
+    void onPong();
+    // true if the message is queued for the sender
+    bool sendMessage(const char* method, const char* protoname, uint16_t msgId, const ProtobufCMessage* msg,
+                     uint8_t codec, TxLane lane, bool droppable);
+    // packet buffer holds FRAME_HEAD_ROOM free bytes followed by len bytes of payload, methodId 0 means no ids in header
+    void finishFrame(TxPacket* packet, size_t len, uint8_t version, uint8_t codec, uint16_t msgId, uint8_t methodId);
+    // rewrite the header of a v1 packet as v2, payload stays where it is
+    void reframe(TxPacket* packet);
+    void startSender();
+    void senderLoop();
+    // return true if the message is consumed by transport layer
+    bool handleTransportConfig(Rpc__Request* req, uint16_t msgId);
+    FrameReassembler m_frameReassembler;
+    // everything unpacked/parsed from one inbound message lives here
+    MessageArena    m_recvArena;
+    ZlibCodec       m_codec;
+    TxQueue         m_txQueue;
+    TaskHandle_t    m_senderHandle = nullptr;
+    // deflate stream, pack buffer and stats are shared by all senders
+    std::mutex      m_sendMutex;
+    uint8_t*        m_pPackBuffer = nullptr;
+    size_t          m_nPackBufferSize = 0;
+    SendStats       m_sendStats;
+    // outgoing framing, packets are tagged with the version they were built for
+    std::atomic<uint8_t> m_framingVersion = FRAMING_V1;
+    // incoming framing, recv thread only
+    uint8_t         m_recvFramingVersion = FRAMING_V1;
+    std::atomic<bool> m_bMsgIdMode = false;
     int32_t         m_timeDiff = 0;
+    // send time of the unanswered ping
+    std::atomic<int64_t> m_pingSentTime{0};
+    std::atomic<uint32_t> m_nRttUs{0};
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "render_damage.h"
+
+// more rects than this are collapsed into their bounding box, lvgl's invalidation
+// buffer falls back to a full screen redraw when it overflows
+#define MAX_DAMAGE_RECTS 8
+
+RenderDamage::RenderDamage(uint16_t width, uint16_t height, uint16_t tileSize)
+: m_nWidth(width), m_nHeight(height), m_nTileSize(tileSize) {
+    m_nCols = (width + tileSize - 1) / tileSize;
+    m_nRows = (height + tileSize - 1) / tileSize;
+    m_hashes.resize(m_nCols * m_nRows, 0);
+    m_rowHashes.resize(m_nCols);
+    m_rects.reserve(m_nCols * m_nRows);
+    m_open.reserve(m_nCols);
+    m_nextOpen.reserve(m_nCols);
+}
+
+const std::vector<DamageRect>& RenderDamage::update(const uint16_t* pixels) {
+    m_rects.clear();
+    m_open.clear();
+    m_nDamagedPixels = 0;
+    for (uint16_t row = 0; row < m_nRows; row++) {
+        // fnv-1a per tile, the frame is read row by row in memory order
+        for (auto& hash : m_rowHashes) {
+            hash = 2166136261u;
+        }
+        uint16_t yEnd = (row + 1) * m_nTileSize;
+        if (yEnd > m_nHeight) {
+            yEnd = m_nHeight;
+        }
+        for (uint16_t y = row * m_nTileSize; y < yEnd; y++) {
+            const uint16_t* line = pixels + (size_t)y * m_nWidth;
+            for (uint16_t col = 0; col < m_nCols; col++) {
+                uint16_t xEnd = (col + 1) * m_nTileSize;
+                if (xEnd > m_nWidth) {
+                    xEnd = m_nWidth;
+                }
+                uint32_t hash = m_rowHashes[col];
+                for (uint16_t x = col * m_nTileSize; x < xEnd; x++) {
+                    hash = (hash ^ line[x]) * 16777619u;
+                }
+                m_rowHashes[col] = hash;
+            }
+        }
+        m_nextOpen.clear();
+        int first = -1;
+        for (uint16_t col = 0; col <= m_nCols; col++) {
+            bool dirty = false;
+            if (col < m_nCols) {
+                uint32_t& last = m_hashes[row * m_nCols + col];
+                dirty = !m_bValid || last != m_rowHashes[col];
+                last = m_rowHashes[col];
+            }
+            if (dirty && first < 0) {
+                first = col;
+            } else if (!dirty && first >= 0) {
+                addSpan(row, first, col - 1);
+                first = -1;
+            }
+        }
+        m_open.swap(m_nextOpen);
+    }
+    m_bValid = true;
+    if (m_rects.size() > MAX_DAMAGE_RECTS) {
+        DamageRect bounds = m_rects[0];
+        for (auto& rect : m_rects) {
+            if (rect.x1 < bounds.x1) bounds.x1 = rect.x1;
+            if (rect.y1 < bounds.y1) bounds.y1 = rect.y1;
+            if (rect.x2 > bounds.x2) bounds.x2 = rect.x2;
+            if (rect.y2 > bounds.y2) bounds.y2 = rect.y2;
+        }
+        m_rects.clear();
+        m_rects.push_back(bounds);
+    }
+    for (auto& rect : m_rects) {
+        m_nDamagedPixels += rect.pixels();
+    }
+    return m_rects;
+}
+
+void RenderDamage::addSpan(uint16_t tileRow, uint16_t firstCol, uint16_t lastCol) {
+    int16_t x1 = firstCol * m_nTileSize;
+    int16_t x2 = (lastCol + 1) * m_nTileSize - 1;
+    if (x2 >= m_nWidth) {
+        x2 = m_nWidth - 1;
+    }
+    int16_t y1 = tileRow * m_nTileSize;
+    int16_t y2 = (tileRow + 1) * m_nTileSize - 1;
+    if (y2 >= m_nHeight) {
+        y2 = m_nHeight - 1;
+    }
+    // same columns as a rect ending right above, grow it down
+    for (auto index : m_open) {
+        DamageRect& rect = m_rects[index];
+        if (rect.x1 == x1 && rect.x2 == x2) {
+            rect.y2 = y2;
+            m_nextOpen.push_back(index);
+            return;
+        }
+    }
+    m_nextOpen.push_back(m_rects.size());
+    m_rects.push_back({x1, y1, x2, y2});
+}
@@ -0,0 +1,48 @@
+#ifndef _RENDER_DAMAGE_H_
+#define _RENDER_DAMAGE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// inclusive corners, like lv_area_t
+struct DamageRect {
+    int16_t x1;
+    int16_t y1;
+    int16_t x2;
+    int16_t y2;
+    uint32_t pixels() const { return (uint32_t)(x2 - x1 + 1) * (y2 - y1 + 1); }
+};
+
+// Finds what changed in the engine render buffer since the last frame. The engine
+// has no damage reporting, so every frame is hashed in tiles and changed tiles are
+// merged into a few rectangles for lvgl to invalidate.
+// Hashing reads the frame once and needs no copy of the previous one.
+class RenderDamage {
+public:
+    RenderDamage(uint16_t width, uint16_t height, uint16_t tileSize = 16);
+    // rgb565 frame of width * height, result is valid until the next update
+    const std::vector<DamageRect>& update(const uint16_t* pixels);
+    // next update reports the whole frame
+    void invalidateAll() { m_bValid = false; }
+    uint32_t getDamagedPixels() const { return m_nDamagedPixels; }
+private:
+    void addSpan(uint16_t tileRow, uint16_t firstCol, uint16_t lastCol);
+
+    uint16_t                m_nWidth;
+    uint16_t                m_nHeight;
+    uint16_t                m_nTileSize;
+    uint16_t                m_nCols;
+    uint16_t                m_nRows;
+    // hash of every tile in the last frame
+    std::vector<uint32_t>   m_hashes;
+    // hashes of the tile row being read
+    std::vector<uint32_t>   m_rowHashes;
+    std::vector<DamageRect> m_rects;
+    // rects that end on the previous tile row may still grow downwards
+    std::vector<uint16_t>   m_open;
+    std::vector<uint16_t>   m_nextOpen;
+    uint32_t                m_nDamagedPixels = 0;
+    bool                    m_bValid = false;
+};
+
+#endif
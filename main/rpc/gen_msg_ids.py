@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+# Generate numeric message ids from the message descriptors declared in msg.pb-c.h.
+# Ids follow declaration order, which is the order of msg.proto, so the server
+# must generate its table from the same msg.proto.
+# usage: gen_msg_ids.py msg.pb-c.h msg_ids.h
+import re
+import sys
+
+
+def camel_name(c_name, typedefs):
+    # rpc__bytes_msg -> BytesMsg, resolved through the typedefs to keep protoc's own spelling
+    for name in typedefs:
+        if name.lower() == c_name.replace('_', ''):
+            return name
+    return None
+
+
+def main():
+    src, dst = sys.argv[1], sys.argv[2]
+    with open(src, encoding='utf-8') as f:
+        header = f.read()
+    typedefs = re.findall(r'typedef struct Rpc__(\w+) Rpc__\w+;', header)
+    descriptors = re.findall(r'extern const ProtobufCMessageDescriptor rpc__(\w+)__descriptor;', header)
+    messages = []
+    for desc in descriptors:
+        name = camel_name(desc, typedefs)
+        if name is None:
+            sys.exit('no struct found for descriptor rpc__%s__descriptor' % desc)
+        messages.append((name, desc))
+
+    out = []
+    out.append('/* Generated by gen_msg_ids.py from msg.pb-c.h.  DO NOT EDIT! */')
+    out.append('#ifndef _RPC_MSG_IDS_H_')
+    out.append('#define _RPC_MSG_IDS_H_')
+    out.append('#include <stdint.h>')
+    out.append('#include <string.h>')
+    out.append('#include "msg.pb-c.h"')
+    out.append('')
+    out.append('#define RPC_MSG_ID_LIST(X) \\')
+    for i, (name, desc) in enumerate(messages):
+        tail = ' \\' if i < len(messages) - 1 else ''
+        out.append('    X(%s, %d, rpc__%s__descriptor)%s' % (name, i + 1, desc, tail))
+    out.append('')
+    out.append('enum RpcMsgId : uint16_t {')
+    out.append('    RPC_MSG_ID_None = 0,')
+    for i, (name, _) in enumerate(messages):
+        out.append('    RPC_MSG_ID_%s = %d,' % (name, i + 1))
+    out.append('    RPC_MSG_ID_COUNT')
+    out.append('};')
+    out.append('')
+    out.append('// protoname as carried in Rpc__Request, e.g. "BytesMsg"')
+    out.append('static inline uint16_t rpcMsgIdFromName(const char* name) {')
+    out.append('    if (!name)')
+    out.append('        return RPC_MSG_ID_None;')
+    out.append('#define RPC_MSG_ID_MATCH(proto, id, descriptor) if (strcmp(name, #proto) == 0) return id;')
+    out.append('    RPC_MSG_ID_LIST(RPC_MSG_ID_MATCH)')
+    out.append('#undef RPC_MSG_ID_MATCH')
+    out.append('    return RPC_MSG_ID_None;')
+    out.append('}')
+    out.append('')
+    out.append('#endif')
+    with open(dst, 'w', encoding='utf-8', newline='\n') as f:
+        f.write('\n'.join(out) + '\n')
+
+
+if __name__ == '__main__':
+    main()
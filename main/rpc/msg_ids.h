@@ -0,0 +1,65 @@
+/* Generated by gen_msg_ids.py from msg.pb-c.h.  DO NOT EDIT! */
+#ifndef _RPC_MSG_IDS_H_
+#define _RPC_MSG_IDS_H_
+#include <stdint.h>
+#include <string.h>
+#include "msg.pb-c.h"
+
+#define RPC_MSG_ID_LIST(X) \
+    X(Request, 1, rpc__request__descriptor) \
+    X(Msg, 2, rpc__msg__descriptor) \
+    X(NumberMsg, 3, rpc__number_msg__descriptor) \
+    X(BytesMsg, 4, rpc__bytes_msg__descriptor) \
+    X(Ping, 5, rpc__ping__descriptor) \
+    X(Login, 6, rpc__login__descriptor) \
+    X(ThirdPartyAuthority, 7, rpc__third_party_authority__descriptor) \
+    X(BroadcastMessage, 8, rpc__broadcast_message__descriptor) \
+    X(DeliverMessage, 9, rpc__deliver_message__descriptor) \
+    X(ServerInfo, 10, rpc__server_info__descriptor) \
+    X(Player, 11, rpc__player__descriptor) \
+    X(LoginResult, 12, rpc__login_result__descriptor) \
+    X(ErrorCode, 13, rpc__error_code__descriptor) \
+    X(KeyValue, 14, rpc__key_value__descriptor) \
+    X(Configs, 15, rpc__configs__descriptor) \
+    X(AssistantConfig, 16, rpc__assistant_config__descriptor) \
+    X(KLine, 17, rpc__kline__descriptor) \
+    X(Security, 18, rpc__security__descriptor) \
+    X(Securities, 19, rpc__securities__descriptor) \
+    X(SecurityKLines, 20, rpc__security_klines__descriptor)
+
+enum RpcMsgId : uint16_t {
+    RPC_MSG_ID_None = 0,
+    RPC_MSG_ID_Request = 1,
+    RPC_MSG_ID_Msg = 2,
+    RPC_MSG_ID_NumberMsg = 3,
+    RPC_MSG_ID_BytesMsg = 4,
+    RPC_MSG_ID_Ping = 5,
+    RPC_MSG_ID_Login = 6,
+    RPC_MSG_ID_ThirdPartyAuthority = 7,
+    RPC_MSG_ID_BroadcastMessage = 8,
+    RPC_MSG_ID_DeliverMessage = 9,
+    RPC_MSG_ID_ServerInfo = 10,
+    RPC_MSG_ID_Player = 11,
+    RPC_MSG_ID_LoginResult = 12,
+    RPC_MSG_ID_ErrorCode = 13,
+    RPC_MSG_ID_KeyValue = 14,
+    RPC_MSG_ID_Configs = 15,
+    RPC_MSG_ID_AssistantConfig = 16,
+    RPC_MSG_ID_KLine = 17,
+    RPC_MSG_ID_Security = 18,
+    RPC_MSG_ID_Securities = 19,
+    RPC_MSG_ID_SecurityKLines = 20,
+    RPC_MSG_ID_COUNT
+};
+
+// protoname as carried in Rpc__Request, e.g. "BytesMsg"
+static inline uint16_t rpcMsgIdFromName(const char* name) {
+    if (!name)
+        return RPC_MSG_ID_None;
+#define RPC_MSG_ID_MATCH(proto, id, descriptor) if (strcmp(name, #proto) == 0) return id;
+    RPC_MSG_ID_LIST(RPC_MSG_ID_MATCH)
+#undef RPC_MSG_ID_MATCH
+    return RPC_MSG_ID_None;
+}
+
+#endif
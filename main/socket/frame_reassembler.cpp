@@ -0,0 +1,107 @@
+#include "frame_reassembler.h"
+#include <string.h>
+#include "utils/logger.h"
+#include "core/memory_allocator.h"
+
+// data in big endian
+static inline size_t readFrameLen(const uint8_t* data) {
+    return (static_cast<size_t>(data[0]) << 24) |
+           (static_cast<size_t>(data[1]) << 16) |
+           (static_cast<size_t>(data[2]) << 8)  |
+           (static_cast<size_t>(data[3]));
+}
+
+FrameReassembler::FrameReassembler(size_t initCapacity, size_t maxFrameSize)
+: m_nMaxFrameSize(maxFrameSize) {
+    reserve(initCapacity);
+}
+
+FrameReassembler::~FrameReassembler() {
+    if (m_pBuffer) {
+        free(m_pBuffer);
+        m_pBuffer = nullptr;
+    }
+}
+
+bool FrameReassembler::reserve(size_t size) {
+    if (size <= m_nCapacity) {
+        return true;
+    }
+    // grow geometrically so a big frame arriving in small pieces does not realloc on every chunk
+    size_t newCapacity = m_nCapacity ? m_nCapacity : 1024;
+    while (newCapacity < size) {
+        newCapacity *= 2;
+    }
+    uint8_t* newBuffer = nullptr;
+    if (m_pBuffer)
+        newBuffer = (uint8_t*)psram_prefered_realloc(m_pBuffer, newCapacity);
+    else
+        newBuffer = (uint8_t*)psram_prefered_malloc(newCapacity);
+    if (!newBuffer) {
+        LOGE("frame buffer grow to %zu failed\n", newCapacity);
+        return false;
+    }
+    m_pBuffer = newBuffer;
+    m_nCapacity = newCapacity;
+    return true;
+}
+
+bool FrameReassembler::stash(const uint8_t* data, size_t len) {
+    if (!reserve(m_nDataLen + len)) {
+        return false;
+    }
+    memcpy(m_pBuffer + m_nDataLen, data, len);
+    m_nDataLen += len;
+    return true;
+}
+
+bool FrameReassembler::feed(const uint8_t* data, size_t len, const FrameCallback& onFrame) {
+    while (len > 0) {
+        if (m_nDataLen == 0) {
+            // fast path, nothing pending: hand out every complete frame straight from the chunk
+            while (len >= FRAME_LEN_PREFIX_SIZE) {
+                size_t frameLen = readFrameLen(data);
+                if (frameLen > m_nMaxFrameSize) {
+                    LOGE("frame too large: %zu\n", frameLen);
+                    return false;
+                }
+                size_t packetLen = frameLen + FRAME_LEN_PREFIX_SIZE;
+                if (len < packetLen) {
+                    break;
+                }
+                onFrame(data + FRAME_LEN_PREFIX_SIZE, frameLen);
+                data += packetLen;
+                len -= packetLen;
+            }
+            // keep the partial tail for next time
+            return len ? stash(data, len) : true;
+        }
+        // slow path: only copy what the pending frame is still missing
+        size_t need = 0;
+        if (m_nDataLen < FRAME_LEN_PREFIX_SIZE) {
+            need = FRAME_LEN_PREFIX_SIZE - m_nDataLen;
+        } else {
+            need = readFrameLen(m_pBuffer) + FRAME_LEN_PREFIX_SIZE - m_nDataLen;
+        }
+        size_t copyLen = len < need ? len : need;
+        if (!stash(data, copyLen)) {
+            return false;
+        }
+        data += copyLen;
+        len -= copyLen;
+        if (m_nDataLen < FRAME_LEN_PREFIX_SIZE) {
+            continue;
+        }
+        size_t frameLen = readFrameLen(m_pBuffer);
+        if (frameLen > m_nMaxFrameSize) {
+            LOGE("frame too large: %zu\n", frameLen);
+            reset();
+            return false;
+        }
+        if (m_nDataLen == frameLen + FRAME_LEN_PREFIX_SIZE) {
+            onFrame(m_pBuffer + FRAME_LEN_PREFIX_SIZE, frameLen);
+            reset();
+        }
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+#ifndef _FRAME_REASSEMBLER_H_
+#define _FRAME_REASSEMBLER_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+// protocal structure: length | data
+//                     4bytes | variant bytes
+#define FRAME_LEN_PREFIX_SIZE 4
+
+// Rebuilds length prefixed frames out of a tcp byte stream.
+// Complete frames inside a received chunk are handed out in place, only the
+// trailing partial frame is copied into the staging buffer, which therefore never
+// holds more than one frame and never needs to shift data around.
+class FrameReassembler {
+public:
+    // frame view is only valid inside the callback
+    using FrameCallback = std::function<void(const uint8_t* frame, size_t len)>;
+
+    FrameReassembler(size_t initCapacity = 1024 * 4, size_t maxFrameSize = 1024 * 1024 * 2);
+    ~FrameReassembler();
+    // return false if stream is corrupted (frame too large or out of memory), caller should drop the connection
+    bool feed(const uint8_t* data, size_t len, const FrameCallback& onFrame);
+    void reset() { m_nDataLen = 0; }
+    size_t getCapacity() const { return m_nCapacity; }
+    size_t getPendingLen() const { return m_nDataLen; }
+private:
+    bool reserve(size_t size);
+    bool stash(const uint8_t* data, size_t len);
+
+    uint8_t*        m_pBuffer = nullptr;
+    size_t          m_nCapacity = 0;
+    size_t          m_nDataLen = 0;
+    const size_t    m_nMaxFrameSize;
+};
+
+#endif
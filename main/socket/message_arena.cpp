@@ -0,0 +1,120 @@
+#include "message_arena.h"
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "utils/logger.h"
+#include "core/memory_allocator.h"
+
+#define ARENA_ALIGN 8
+#define ALIGN_UP(size) (((size) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static thread_local MessageArena* t_currentArena = nullptr;
+
+MessageArena::MessageArena(size_t blockSize) {
+    m_nBlockSize = ALIGN_UP(blockSize);
+    m_pBuffer = (uint8_t*)psram_prefered_malloc(m_nBlockSize);
+    assert(m_pBuffer);
+    m_pbAllocator.alloc = [](void* data, size_t size) {
+        auto arena = (MessageArena*)data;
+        void* ptr = arena->alloc(size);
+#ifndef NDEBUG
+        if (ptr) {
+            arena->m_nLive++;
+        }
+#endif
+        return ptr;
+    };
+    m_pbAllocator.free = [](void* data, void* ptr) {
+        // released on reset
+#ifndef NDEBUG
+        if (ptr) {
+            ((MessageArena*)data)->m_nLive--;
+        }
+#endif
+    };
+    m_pbAllocator.allocator_data = this;
+}
+
+MessageArena::~MessageArena() {
+    reset();
+    if (m_pBuffer) {
+        free(m_pBuffer);
+        m_pBuffer = nullptr;
+    }
+}
+
+void* MessageArena::alloc(size_t size) {
+    size = ALIGN_UP(size);
+    void* ptr = nullptr;
+    if (m_nOffset + size <= m_nBlockSize) {
+        ptr = m_pBuffer + m_nOffset;
+        m_nOffset += size;
+    } else {
+        // first block is full, chain an overflow block big enough for this request
+        size_t blockSize = ALIGN_UP(sizeof(Block)) + (size > m_nBlockSize ? size : m_nBlockSize);
+        Block* block = (Block*)psram_prefered_malloc(blockSize);
+        if (!block) {
+            LOGE("arena overflow malloc failed: %zu\n", blockSize);
+            return nullptr;
+        }
+        block->next = m_pOverflow;
+        block->size = blockSize;
+        m_pOverflow = block;
+        ptr = (uint8_t*)block + ALIGN_UP(sizeof(Block));
+        // rest of the overflow block is not reused, a message rarely overflows twice
+    }
+    m_nUsed += size;
+    if (m_nUsed > m_nPeak) {
+        m_nPeak = m_nUsed;
+    }
+    return ptr;
+}
+
+void MessageArena::reset() {
+    while (m_pOverflow) {
+        Block* next = m_pOverflow->next;
+        free(m_pOverflow);
+        m_pOverflow = next;
+    }
+#ifndef NDEBUG
+    // a message still used after its scope reads garbage instead of plausible old data
+    memset(m_pBuffer, 0xA5, m_nOffset);
+    m_nLive = 0;
+#endif
+    m_nOffset = 0;
+    m_nUsed = 0;
+}
+
+bool MessageArena::owns(const void* ptr) const {
+    auto p = (const uint8_t*)ptr;
+    if (p >= m_pBuffer && p < m_pBuffer + m_nBlockSize) {
+        return true;
+    }
+    for (Block* block = m_pOverflow; block; block = block->next) {
+        if (p >= (const uint8_t*)block && p < (const uint8_t*)block + block->size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+MessageArena::Scope::Scope(MessageArena* arena) {
+    m_pPrevious = t_currentArena;
+    t_currentArena = arena;
+}
+
+MessageArena::Scope::~Scope() {
+    // nested scope of the same arena leaves the reset to the outer one
+    if (t_currentArena != m_pPrevious) {
+#ifndef NDEBUG
+        // something unpacked in this scope was not freed, it may still be held somewhere
+        assert(t_currentArena->m_nLive == 0);
+#endif
+        t_currentArena->reset();
+    }
+    t_currentArena = m_pPrevious;
+}
+
+ProtobufCAllocator* MessageArena::currentAllocator() {
+    return t_currentArena ? t_currentArena->getProtobufAllocator() : nullptr;
+}
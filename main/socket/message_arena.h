@@ -0,0 +1,59 @@
+#ifndef _MESSAGE_ARENA_H_
+#define _MESSAGE_ARENA_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "protobuf-c/protobuf-c.h"
+
+// Bump pointer arena that lives for one inbound message.
+// protobuf-c unpacks of the message allocate from it and the whole thing is released
+// by a single reset, so long sessions don't fragment the heap.
+// Only protobuf-c uses it: every unpack is paired with a free_unpacked in the same scope,
+// nothing from the arena may be kept once the scope ends. cJSON stays on the heap since
+// parsed json is handed to callbacks that may keep it.
+// Memory comes from PSRAM, overflow blocks are chained when the first block is full.
+class MessageArena {
+public:
+    MessageArena(size_t blockSize = 1024 * 16);
+    ~MessageArena();
+
+    void* alloc(size_t size);
+    // release everything allocated since last reset, overflow blocks are freed
+    void reset();
+    bool owns(const void* ptr) const;
+    size_t getUsed() const { return m_nUsed; }
+    // high water mark across all resets, above the block size messages needed overflow blocks
+    size_t getPeak() const { return m_nPeak; }
+    size_t getBlockSize() const { return m_nBlockSize; }
+    ProtobufCAllocator* getProtobufAllocator() { return &m_pbAllocator; }
+
+    // While a scope is alive currentAllocator() returns the arena's protobuf allocator on the
+    // current task. Arena is reset when scope ends, debug builds assert every unpacked message was freed.
+    class Scope {
+    public:
+        Scope(MessageArena* arena);
+        ~Scope();
+    private:
+        MessageArena* m_pPrevious;
+    };
+    // allocator of the arena in scope on current task, nullptr(protobuf-c default) if none
+    static ProtobufCAllocator* currentAllocator();
+private:
+    struct Block {
+        Block*  next;
+        size_t  size;
+    };
+
+    uint8_t*            m_pBuffer = nullptr;
+    size_t              m_nBlockSize = 0;
+    size_t              m_nOffset = 0;
+    Block*              m_pOverflow = nullptr;
+    size_t              m_nUsed = 0;
+    size_t              m_nPeak = 0;
+#ifndef NDEBUG
+    // allocations not given back by protobuf-c free yet
+    size_t              m_nLive = 0;
+#endif
+    ProtobufCAllocator  m_pbAllocator;
+};
+
+#endif
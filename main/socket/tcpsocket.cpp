@@ -149,18 +149,75 @@ void printHex(const void* ptr, size_t size) {
 }
 
 int TcpSocket::send(const char* data, unsigned int len, uint8_t _useless) {
-    // protocal structure: length | data
-    //                     4bytes | variant bytes
     std::lock_guard<std::mutex> lock(m_socketMutex);
     int packetLen = len + 4;
     bufferResize(packetLen); 
-    int bigEndianSize = htonl(len);
-    memcpy(m_pSendBuffer, &bigEndianSize, 4);
     memcpy(m_pSendBuffer+4, data, len);
+    return writePacket(m_pSendBuffer, packetLen);
+}
+
+int TcpSocket::sendBatch(const uint8_t* const* packets, const size_t* packetLens, size_t count) {
+    std::lock_guard<std::mutex> lock(m_socketMutex);
+#if USE_TCP_PCB_CLIENT
+    int total = 0;
+    for (size_t i = 0; i < count; i++) {
+        auto ret = tcp_client_send((void*)packets[i], packetLens[i]);
+        if (ret < 0) {
+            LOGE("send error: %d\n", ret);
+            return ret;
+        }
+        total += ret;
+    }
+    return total;
+#else
+    if (count > TCP_SEND_BATCH_MAX) {
+        LOGE("too many packets in one batch: %zu\n", count);
+        return -1;
+    }
+    struct iovec iov[TCP_SEND_BATCH_MAX];
+    size_t remain = 0;
+    for (size_t i = 0; i < count; i++) {
+        iov[i].iov_base = (void*)packets[i];
+        iov[i].iov_len = packetLens[i];
+        remain += packetLens[i];
+    }
+    int total = 0;
+    struct iovec* cur = iov;
+    int iovcnt = count;
+    while (remain > 0) {
+        auto ret = ::writev(m_socket, cur, iovcnt);
+        if (ret < 0) {
+            if (errno == EAGAIN)
+                LOGE("send error: EAGAIN\n");
+            LOGE("send error: %d\n", ret);
+            return ret;
+        }
+        total += ret;
+        remain -= ret;
+        // partial write, skip what is already out
+        while (iovcnt && (size_t)ret >= cur->iov_len) {
+            ret -= cur->iov_len;
+            cur++;
+            iovcnt--;
+        }
+        if (iovcnt) {
+            cur->iov_base = (uint8_t*)cur->iov_base + ret;
+            cur->iov_len -= ret;
+        }
+    }
+    return total;
+#endif
+}
+
+int TcpSocket::writePacket(uint8_t* packet, size_t packetLen) {
+    // protocal structure: length | data
+    //                     4bytes | variant bytes
+    int bigEndianSize = htonl(packetLen - 4);
+    memcpy(packet, &bigEndianSize, 4);
 #if USE_TCP_PCB_CLIENT
-    auto ret = tcp_client_send(m_pSendBuffer, packetLen);
+    auto ret = tcp_client_send(packet, packetLen);
 #else
-    auto ret = ::send(m_socket, m_pSendBuffer, packetLen, 0);
+    auto ret = ::send(m_socket, packet, packetLen, 0);
 #endif
     if (ret < 0) {
 #if !USE_TCP_PCB_CLIENT
@@ -5,6 +5,9 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 
+// max packets handed to sendBatch at once
+#define TCP_SEND_BATCH_MAX 16
+
 class TcpSocket : public Socket
 {
 public:
@@ -19,16 +22,21 @@ public:
 
     void setSocketListener(SocketListener* listener) { m_pListener = listener; }
     virtual void onDataReceived(uint8_t* data, size_t len) = 0;
-    void onConnected();
+    virtual void onConnected();
     // Internal use only
     bool recvData();
 protected:
+    // write several complete packets(length prefix already filled) with a single syscall,
+    // count must not exceed TCP_SEND_BATCH_MAX
+    int sendBatch(const uint8_t* const* packets, const size_t* packetLens, size_t count);
+    virtual void onDisconnected();
     SocketListener*     m_pListener = nullptr;
 private:
-    void onDisconnected();
     void setState(ConnectState state) { m_eState = state; }
     void dataReceived(uint8_t* data, size_t len);
     void bufferResize(uint32_t size);
+    // caller must hold m_socketMutex
+    int writePacket(uint8_t* packet, size_t packetLen);
     void createRecvThread();
     int                 m_socket = -7;
     std::string         m_host;
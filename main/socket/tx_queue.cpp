@@ -0,0 +1,216 @@
+#include "tx_queue.h"
+#include <stdlib.h>
+#include <chrono>
+#include "esp_timer.h"
+#include "utils/logger.h"
+#include "core/memory_allocator.h"
+
+TxQueue::TxQueue(uint16_t audioCapacity, uint16_t controlCapacity, uint16_t bulkCapacity) {
+    uint16_t capacities[TX_LANE_COUNT] = {audioCapacity, controlCapacity, bulkCapacity};
+    size_t total = 0;
+    for (int i = 0; i < TX_LANE_COUNT; i++) {
+        m_lanes[i].ring.resize(capacities[i], nullptr);
+        total += capacities[i];
+    }
+    // every lane slot has its own packet, so acquire never runs out of packets before the lane is full
+    m_packets.resize(total);
+    m_freePackets.reserve(total);
+    for (auto& packet : m_packets) {
+        m_freePackets.push_back(&packet);
+    }
+}
+
+TxQueue::~TxQueue() {
+    for (auto& packet : m_packets) {
+        if (packet.buffer) {
+            free(packet.buffer);
+            packet.buffer = nullptr;
+        }
+    }
+}
+
+TxPacket* TxQueue::acquire(TxLane lane, size_t size, bool droppable, uint32_t waitMs) {
+    TxPacket* packet = nullptr;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        Lane& l = m_lanes[lane];
+        if (l.inUse >= l.ring.size() && lane == TX_LANE_AUDIO) {
+            // fresh audio is worth more than the oldest queued frame
+            auto oldest = l.count ? l.ring[l.head] : nullptr;
+            if (oldest && oldest->droppable) {
+                popLane(l);
+                recycleLocked(oldest);
+                m_stats.lanes[lane].droppedFull++;
+            }
+        }
+        if (l.inUse >= l.ring.size()) {
+            m_spaceCv.wait_for(lock, std::chrono::milliseconds(waitMs), [&l]() {
+                return l.inUse < l.ring.size();
+            });
+            if (l.inUse >= l.ring.size()) {
+                m_stats.lanes[lane].droppedFull++;
+                return nullptr;
+            }
+        }
+        // prefer a pooled buffer that is already big enough
+        size_t index = m_freePackets.size() - 1;
+        for (size_t i = 0; i < m_freePackets.size(); i++) {
+            if (m_freePackets[i]->capacity >= size) {
+                index = i;
+                break;
+            }
+        }
+        packet = m_freePackets[index];
+        m_freePackets[index] = m_freePackets.back();
+        m_freePackets.pop_back();
+        l.inUse++;
+    }
+    packet->lane = lane;
+    packet->droppable = droppable;
+    packet->data = packet->buffer;
+    packet->len = 0;
+    if (!reserve(packet, size)) {
+        release(packet);
+        return nullptr;
+    }
+    return packet;
+}
+
+bool TxQueue::reserve(TxPacket* packet, size_t size) {
+    if (size <= packet->capacity) {
+        return true;
+    }
+    uint8_t* buffer = nullptr;
+    if (packet->buffer)
+        buffer = (uint8_t*)psram_prefered_realloc(packet->buffer, size);
+    else
+        buffer = (uint8_t*)psram_prefered_malloc(size);
+    if (!buffer) {
+        LOGE("malloc failed not enough memory:%zu\n", size);
+        return false;
+    }
+    packet->data = buffer + (packet->data - packet->buffer);
+    packet->buffer = buffer;
+    packet->capacity = size;
+    return true;
+}
+
+void TxQueue::commit(TxPacket* packet) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Lane& l = m_lanes[packet->lane];
+        packet->enqueueTime = esp_timer_get_time();
+        l.ring[(l.head + l.count) % l.ring.size()] = packet;
+        l.count++;
+        auto& stats = m_stats.lanes[packet->lane];
+        stats.queued++;
+        if (l.count > stats.maxDepth) {
+            stats.maxDepth = l.count;
+        }
+    }
+    m_readyCv.notify_one();
+}
+
+void TxQueue::release(TxPacket* packet) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        recycleLocked(packet);
+    }
+    m_spaceCv.notify_all();
+}
+
+size_t TxQueue::popBatch(TxPacket** out, size_t max, uint32_t waitMs) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto ready = [this]() {
+        for (auto& l : m_lanes) {
+            if (l.count) {
+                return true;
+            }
+        }
+        return false;
+    };
+    if (!ready()) {
+        m_readyCv.wait_for(lock, std::chrono::milliseconds(waitMs), ready);
+    }
+    int64_t now = esp_timer_get_time();
+    size_t n = 0;
+    bool dropped = false;
+    for (int lane = 0; lane < TX_LANE_COUNT && n < max; lane++) {
+        Lane& l = m_lanes[lane];
+        while (l.count && n < max) {
+            TxPacket* packet = popLane(l);
+            if (packet->droppable && now - packet->enqueueTime > m_nAudioDeadlineUs) {
+                // too late to be played in time, server would only add it to the backlog
+                m_stats.lanes[lane].droppedStale++;
+                recycleLocked(packet);
+                dropped = true;
+                continue;
+            }
+            out[n++] = packet;
+        }
+    }
+    if (n) {
+        m_stats.batches++;
+    }
+    lock.unlock();
+    if (dropped) {
+        m_spaceCv.notify_all();
+    }
+    return n;
+}
+
+void TxQueue::recycle(TxPacket** packets, size_t count, bool sent) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int64_t now = esp_timer_get_time();
+        for (size_t i = 0; i < count; i++) {
+            TxPacket* packet = packets[i];
+            if (sent) {
+                m_stats.lanes[packet->lane].sent++;
+                uint32_t latency = now - packet->enqueueTime;
+                if (latency > m_stats.maxLatency) {
+                    m_stats.maxLatency = latency;
+                }
+                m_stats.totalLatency += latency;
+                m_stats.latencySamples++;
+            }
+            recycleLocked(packet);
+        }
+    }
+    m_spaceCv.notify_all();
+}
+
+void TxQueue::clear() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& l : m_lanes) {
+            while (l.count) {
+                recycleLocked(popLane(l));
+            }
+        }
+    }
+    m_spaceCv.notify_all();
+}
+
+TxStats TxQueue::getStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    TxStats stats = m_stats;
+    for (int i = 0; i < TX_LANE_COUNT; i++) {
+        stats.lanes[i].depth = m_lanes[i].count;
+    }
+    stats.avgLatency = stats.latencySamples ? stats.totalLatency / stats.latencySamples : 0;
+    return stats;
+}
+
+TxPacket* TxQueue::popLane(Lane& lane) {
+    TxPacket* packet = lane.ring[lane.head];
+    lane.ring[lane.head] = nullptr;
+    lane.head = (lane.head + 1) % lane.ring.size();
+    lane.count--;
+    return packet;
+}
+
+void TxQueue::recycleLocked(TxPacket* packet) {
+    m_lanes[packet->lane].inUse--;
+    m_freePackets.push_back(packet);
+}
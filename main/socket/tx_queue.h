@@ -0,0 +1,98 @@
+#ifndef _TX_QUEUE_H_
+#define _TX_QUEUE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// Lanes are drained in this order, each lane is fifo.
+// Audio lane also carries the listen/abort messages of the audio session so they stay in order with audio.
+enum TxLane : uint8_t {
+    TX_LANE_AUDIO = 0,
+    TX_LANE_CONTROL,
+    TX_LANE_BULK,
+    TX_LANE_COUNT
+};
+
+struct TxPacket {
+    uint8_t*    buffer = nullptr;
+    size_t      capacity = 0;
+    // start and length of the finished packet inside buffer
+    uint8_t*    data = nullptr;
+    size_t      len = 0;
+    int64_t     enqueueTime = 0;
+    TxLane      lane = TX_LANE_CONTROL;
+    // may be dropped when it waited longer than the audio deadline
+    bool        droppable = false;
+    // framing version the header was written for, set by the protocol layer
+    uint8_t     framing = 0;
+};
+
+struct TxLaneStats {
+    uint32_t    queued = 0;
+    uint32_t    sent = 0;
+    uint32_t    droppedFull = 0;
+    uint32_t    droppedStale = 0;
+    uint16_t    depth = 0;
+    uint16_t    maxDepth = 0;
+};
+
+struct TxStats {
+    TxLaneStats lanes[TX_LANE_COUNT];
+    // syscalls made by the sender, packets / batches is the coalescing ratio
+    uint32_t    batches = 0;
+    // enqueue to written, in us
+    uint32_t    maxLatency = 0;
+    uint32_t    avgLatency = 0;
+    // running sums, windowed averages are differences of two snapshots
+    uint64_t    totalLatency = 0;
+    uint32_t    latencySamples = 0;
+};
+
+// Bounded multi producer, single consumer queue of outgoing packets.
+// Packet buffers are pooled and keep their capacity, steady state sending doesn't allocate.
+class TxQueue {
+public:
+    TxQueue(uint16_t audioCapacity = 32, uint16_t controlCapacity = 16, uint16_t bulkCapacity = 8);
+    ~TxQueue();
+    // Producer: take a free packet with at least size bytes of buffer, nullptr if lane stays full.
+    // A full audio lane drops its oldest droppable packet instead of waiting.
+    TxPacket* acquire(TxLane lane, size_t size, bool droppable, uint32_t waitMs = 50);
+    // grow packet buffer, content is kept
+    bool reserve(TxPacket* packet, size_t size);
+    void commit(TxPacket* packet);
+    // give back an acquired packet without sending it
+    void release(TxPacket* packet);
+
+    // Consumer: wait up to waitMs for packets then pop up to max of them in lane order,
+    // droppable packets older than deadline are discarded on the way
+    size_t popBatch(TxPacket** out, size_t max, uint32_t waitMs);
+    void recycle(TxPacket** packets, size_t count, bool sent);
+    // drop everything queued, e.g. on disconnect
+    void clear();
+
+    void setAudioDeadline(uint32_t ms) { m_nAudioDeadlineUs = ms * 1000; }
+    TxStats getStats();
+private:
+    struct Lane {
+        std::vector<TxPacket*>  ring;
+        size_t                  head = 0;
+        size_t                  count = 0;
+        // acquired + queued, bounded by ring size
+        size_t                  inUse = 0;
+    };
+    TxPacket* popLane(Lane& lane);
+    void recycleLocked(TxPacket* packet);
+
+    Lane                        m_lanes[TX_LANE_COUNT];
+    std::vector<TxPacket*>      m_freePackets;
+    std::vector<TxPacket>       m_packets;
+    std::mutex                  m_mutex;
+    std::condition_variable     m_readyCv;
+    std::condition_variable     m_spaceCv;
+    uint32_t                    m_nAudioDeadlineUs = 300 * 1000;
+    TxStats                     m_stats;
+};
+
+#endif
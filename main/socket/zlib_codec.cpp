@@ -0,0 +1,147 @@
+#include "zlib_codec.h"
+#include <string.h>
+#include "utils/logger.h"
+#include "core/memory_allocator.h"
+
+static voidpf zlibAlloc(voidpf, uInt items, uInt size) {
+    return psram_prefered_malloc(items * size);
+}
+
+static void zlibFree(voidpf, voidpf address) {
+    free(address);
+}
+
+ZlibCodec::ZlibCodec(const ZlibCodecConfig& config)
+: m_config(config) {
+    memset(&m_deflateStream, 0, sizeof(m_deflateStream));
+    memset(&m_inflateStream, 0, sizeof(m_inflateStream));
+}
+
+ZlibCodec::~ZlibCodec() {
+    if (m_bDeflateReady) {
+        deflateEnd(&m_deflateStream);
+    }
+    if (m_bInflateReady) {
+        inflateEnd(&m_inflateStream);
+    }
+    if (m_pInflateBuffer) {
+        free(m_pInflateBuffer);
+    }
+}
+
+bool ZlibCodec::initDeflate() {
+    m_deflateStream.zalloc = zlibAlloc;
+    m_deflateStream.zfree = zlibFree;
+    m_deflateStream.opaque = Z_NULL;
+    int ret = deflateInit2(&m_deflateStream, m_config.level, Z_DEFLATED, m_config.windowBits,
+                           m_config.memLevel, Z_DEFAULT_STRATEGY);
+    if (ret != Z_OK) {
+        LOGE("deflateInit2 failed: %d\n", ret);
+        return false;
+    }
+    m_bDeflateReady = true;
+    return true;
+}
+
+bool ZlibCodec::initInflate() {
+    m_inflateStream.zalloc = zlibAlloc;
+    m_inflateStream.zfree = zlibFree;
+    m_inflateStream.opaque = Z_NULL;
+    m_inflateStream.avail_in = 0;
+    m_inflateStream.next_in = Z_NULL;
+    int ret = inflateInit2(&m_inflateStream, m_config.inflateWindowBits);
+    if (ret != Z_OK) {
+        LOGE("inflateInit2 failed: %d\n", ret);
+        return false;
+    }
+    m_bInflateReady = true;
+    return true;
+}
+
+bool ZlibCodec::reserve(uint8_t** buffer, size_t* capacity, size_t size) {
+    if (size <= *capacity) {
+        return true;
+    }
+    uint8_t* newBuffer = nullptr;
+    if (*buffer)
+        newBuffer = (uint8_t*)psram_prefered_realloc(*buffer, size);
+    else
+        newBuffer = (uint8_t*)psram_prefered_malloc(size);
+    if (!newBuffer) {
+        LOGE("malloc failed not enough memory:%zu\n", size);
+        return false;
+    }
+    *buffer = newBuffer;
+    *capacity = size;
+    return true;
+}
+
+bool ZlibCodec::compress(const uint8_t* source, size_t srcLen, uint8_t* dst, size_t dstLen, size_t* outLen) {
+    *outLen = 0;
+    if (!m_bDeflateReady && !initDeflate()) {
+        return false;
+    }
+    // single shot, a dst of deflateBound guarantees Z_FINISH completes in one call
+    m_deflateStream.next_in = (Bytef*)source;
+    m_deflateStream.avail_in = srcLen;
+    m_deflateStream.next_out = dst;
+    m_deflateStream.avail_out = dstLen;
+    int ret = deflate(&m_deflateStream, Z_FINISH);
+    *outLen = dstLen - m_deflateStream.avail_out;
+    deflateReset(&m_deflateStream);
+    if (ret != Z_STREAM_END) {
+        LOGE("deflate error: %d\n", ret);
+        *outLen = 0;
+        return false;
+    }
+    return true;
+}
+
+size_t ZlibCodec::compressBound(size_t srcLen) {
+    if (!m_bDeflateReady && !initDeflate()) {
+        return 0;
+    }
+    return deflateBound(&m_deflateStream, srcLen);
+}
+
+const uint8_t* ZlibCodec::decompress(const uint8_t* source, size_t srcLen, size_t* outLen) {
+    *outLen = 0;
+    if (!m_bInflateReady && !initInflate()) {
+        return nullptr;
+    }
+    // let's say 3x compression at first, grow if payload expands further
+    if (!reserve(&m_pInflateBuffer, &m_nInflateCapacity, srcLen * 3 + 64)) {
+        return nullptr;
+    }
+    m_inflateStream.next_in = (Bytef*)source;
+    m_inflateStream.avail_in = srcLen;
+    int ret = Z_OK;
+    size_t have = 0;
+    while (true) {
+        m_inflateStream.next_out = m_pInflateBuffer + have;
+        m_inflateStream.avail_out = m_nInflateCapacity - have;
+        ret = inflate(&m_inflateStream, Z_NO_FLUSH);
+        have = m_nInflateCapacity - m_inflateStream.avail_out;
+        if (ret == Z_STREAM_END) {
+            break;
+        }
+        if (ret == Z_BUF_ERROR && m_inflateStream.avail_in == 0) {
+            // truncated input
+            break;
+        }
+        if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            break;
+        }
+        if (m_inflateStream.avail_out == 0 &&
+            !reserve(&m_pInflateBuffer, &m_nInflateCapacity, m_nInflateCapacity * 2)) {
+            break;
+        }
+    }
+    inflateReset(&m_inflateStream);
+    if (ret != Z_STREAM_END) {
+        LOGE("inflate error: %d\n", ret);
+        return nullptr;
+    }
+    *outLen = have;
+    return m_pInflateBuffer;
+}
@@ -0,0 +1,43 @@
+#ifndef _ZLIB_CODEC_H_
+#define _ZLIB_CODEC_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "zlib.h"
+
+struct ZlibCodecConfig {
+    int level = Z_BEST_SPEED;
+    // deflate window is 2^windowBits bytes, peer inflates with the default 15 bits so anything smaller is fine
+    int windowBits = 12;
+    // deflate hash memory is 2^(memLevel+9) bytes
+    int memLevel = 4;
+    // must be able to hold the peer's window, keep default 15 unless the server is configured otherwise
+    int inflateWindowBits = MAX_WBITS;
+};
+
+// Per connection zlib codec. Deflate/inflate streams are created once and reset
+// between messages, zlib state is allocated in PSRAM.
+// Not thread safe, compress and decompress may run on different tasks but each side needs a single caller.
+class ZlibCodec {
+public:
+    ZlibCodec(const ZlibCodecConfig& config = ZlibCodecConfig());
+    ~ZlibCodec();
+    // compress into caller's buffer, dstLen of compressBound(srcLen) always fits
+    bool compress(const uint8_t* source, size_t srcLen, uint8_t* dst, size_t dstLen, size_t* outLen);
+    size_t compressBound(size_t srcLen);
+    // returned buffer is owned by codec, valid until next decompress call, grows to fit any payload
+    const uint8_t* decompress(const uint8_t* source, size_t srcLen, size_t* outLen);
+private:
+    bool initDeflate();
+    bool initInflate();
+    static bool reserve(uint8_t** buffer, size_t* capacity, size_t size);
+
+    ZlibCodecConfig     m_config;
+    z_stream            m_deflateStream;
+    z_stream            m_inflateStream;
+    bool                m_bDeflateReady = false;
+    bool                m_bInflateReady = false;
+    uint8_t*            m_pInflateBuffer = nullptr;
+    size_t              m_nInflateCapacity = 0;
+};
+
+#endif
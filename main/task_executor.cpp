@@ -0,0 +1,174 @@
+#include "task_executor.h"
+#include "esp_timer.h"
+#include "utils/logger.h"
+
+TaskExecutor::TaskExecutor(const char* name, uint16_t capacity)
+: m_name(name) {
+    uint32_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    m_nMask = size - 1;
+    for (auto& queue : m_queues) {
+        // cells are allocated once, a cell is free for position p when its seq equals p
+        queue.cells = std::unique_ptr<Cell[]>(new Cell[size]);
+        for (uint32_t i = 0; i < size; i++) {
+            queue.cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+}
+
+void TaskExecutor::post(TaskFunction task, TaskPriority priority) {
+    if (!task.isInline()) {
+        m_nHeapAllocs++;
+    }
+    Queue& queue = m_queues[priority];
+    // tasks behind a spilled one must not overtake it through a freed cell
+    if (queue.spillCount.load(std::memory_order_acquire) || !tryEnqueue(queue, task)) {
+        spill(queue, std::move(task), priority);
+    }
+    m_nPosted++;
+}
+
+bool TaskExecutor::tryEnqueue(Queue& queue, TaskFunction& task) {
+    uint32_t pos = queue.enqueue.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    while (true) {
+        cell = &queue.cells[pos & m_nMask];
+        int32_t diff = (int32_t)(cell->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0) {
+            if (queue.enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // consumer hasn't freed the cell of the previous lap
+            return false;
+        } else {
+            pos = queue.enqueue.load(std::memory_order_relaxed);
+        }
+    }
+    cell->task = std::move(task);
+    cell->enqueueTime = esp_timer_get_time();
+    cell->seq.store(pos + 1, std::memory_order_release);
+    uint16_t depth = pos + 1 - queue.dequeue.load(std::memory_order_relaxed);
+    uint16_t maxDepth = m_nMaxDepth.load(std::memory_order_relaxed);
+    while (depth > maxDepth && !m_nMaxDepth.compare_exchange_weak(maxDepth, depth, std::memory_order_relaxed)) {
+    }
+    return true;
+}
+
+void TaskExecutor::spill(Queue& queue, TaskFunction&& task, TaskPriority priority) {
+    std::lock_guard<std::mutex> lock(queue.spillMutex);
+    if (queue.spill.empty()) {
+        LOGW("%s task queue full, spilling priority: %d\n", m_name, priority);
+    }
+    queue.spill.push_back({esp_timer_get_time(), std::move(task)});
+    queue.spillCount.fetch_add(1, std::memory_order_release);
+    m_nSpilled++;
+}
+
+bool TaskExecutor::runOne(Queue& queue) {
+    uint32_t pos = queue.dequeue.load(std::memory_order_relaxed);
+    Cell& cell = queue.cells[pos & m_nMask];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+        if (!queue.spillCount.load(std::memory_order_acquire)) {
+            return false;
+        }
+        // a claimed cell is still being filled, the tasks spilled behind it have to wait
+        if (queue.enqueue.load(std::memory_order_relaxed) != pos) {
+            return false;
+        }
+        // cells are empty, anything spilled was posted after them
+        SpilledTask spilled;
+        {
+            std::lock_guard<std::mutex> lock(queue.spillMutex);
+            spilled = std::move(queue.spill.front());
+            queue.spill.pop_front();
+            queue.spillCount.fetch_sub(1, std::memory_order_release);
+        }
+        uint32_t latency = esp_timer_get_time() - spilled.enqueueTime;
+        m_totalLatency += latency;
+        if (latency > m_maxLatency) {
+            m_maxLatency = latency;
+        }
+        spilled.task();
+        m_nExecuted++;
+        return true;
+    }
+    uint32_t latency = esp_timer_get_time() - cell.enqueueTime;
+    m_totalLatency += latency;
+    if (latency > m_maxLatency) {
+        m_maxLatency = latency;
+    }
+    // the cell stays claimed while the task runs, tasks it posts go to other cells
+    TaskFunction task = std::move(cell.task);
+    cell.seq.store(pos + m_nMask + 1, std::memory_order_release);
+    queue.dequeue.store(pos + 1, std::memory_order_relaxed);
+    task();
+    m_nExecuted++;
+    return true;
+}
+
+bool TaskExecutor::drain(uint32_t budgetUs) {
+    int64_t start = esp_timer_get_time();
+    while (true) {
+        bool ran = false;
+        // restart from the highest priority after every task
+        for (auto& queue : m_queues) {
+            if (runOne(queue)) {
+                ran = true;
+                break;
+            }
+        }
+        if (!ran) {
+            return false;
+        }
+        if (esp_timer_get_time() - start >= budgetUs) {
+            break;
+        }
+    }
+    if (empty()) {
+        return false;
+    }
+    m_nOverBudget++;
+    return true;
+}
+
+bool TaskExecutor::empty() const {
+    for (auto& queue : m_queues) {
+        uint32_t pos = queue.dequeue.load(std::memory_order_relaxed);
+        if (queue.cells[pos & m_nMask].seq.load(std::memory_order_acquire) == pos + 1 ||
+            queue.spillCount.load(std::memory_order_acquire)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TaskExecutorStats TaskExecutor::getStats() const {
+    TaskExecutorStats stats;
+    stats.posted = m_nPosted;
+    stats.executed = m_nExecuted;
+    stats.spilled = m_nSpilled;
+    stats.heapAllocs = m_nHeapAllocs;
+    for (auto& queue : m_queues) {
+        stats.depth += queue.enqueue.load(std::memory_order_relaxed) - queue.dequeue.load(std::memory_order_relaxed)
+            + queue.spillCount.load(std::memory_order_relaxed);
+    }
+    stats.maxDepth = m_nMaxDepth;
+    stats.totalLatency = m_totalLatency;
+    stats.maxLatency = m_maxLatency;
+    stats.avgLatency = m_nExecuted ? m_totalLatency / m_nExecuted : 0;
+    stats.overBudget = m_nOverBudget;
+    return stats;
+}
+
+void TaskExecutor::logStats() const {
+    auto stats = getStats();
+    if (!stats.posted) {
+        return;
+    }
+    LOGI("%s tasks posted: %u run: %u latency avg: %uus max: %uus depth: %u max: %u heap: %u spilled: %u over budget: %u\n",
+        m_name, stats.posted, stats.executed, stats.avgLatency, stats.maxLatency, stats.depth, stats.maxDepth,
+        stats.heapAllocs, stats.spilled, stats.overBudget);
+}
@@ -0,0 +1,178 @@
+#ifndef _TASK_EXECUTOR_H_
+#define _TASK_EXECUTOR_H_
+#include <stdint.h>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Move only void() callable. Closures up to INLINE_SIZE live inside the object,
+// bigger ones fall back to the heap and isInline() tells so.
+class TaskFunction {
+public:
+    static constexpr size_t INLINE_SIZE = 48;
+
+    TaskFunction() = default;
+    template <typename F, typename = std::enable_if_t<!std::is_same<std::decay_t<F>, TaskFunction>::value>>
+    TaskFunction(F&& f) {
+        using T = std::decay_t<F>;
+        if constexpr (sizeof(T) <= INLINE_SIZE && alignof(T) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<T>::value) {
+            new (m_storage) T(std::forward<F>(f));
+            m_pOps = inlineOps<T>();
+        } else {
+            *(T**)m_storage = new T(std::forward<F>(f));
+            m_pOps = heapOps<T>();
+        }
+    }
+    TaskFunction(TaskFunction&& other) noexcept { moveFrom(other); }
+    TaskFunction& operator=(TaskFunction&& other) noexcept {
+        if (this != &other) {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+    TaskFunction(const TaskFunction&) = delete;
+    TaskFunction& operator=(const TaskFunction&) = delete;
+    ~TaskFunction() { reset(); }
+
+    void operator()() { m_pOps->invoke(m_storage); }
+    explicit operator bool() const { return m_pOps != nullptr; }
+    bool isInline() const { return !m_pOps || m_pOps->inlined; }
+    void reset() {
+        if (m_pOps) {
+            m_pOps->destroy(m_storage);
+            m_pOps = nullptr;
+        }
+    }
+private:
+    struct Ops {
+        void (*invoke)(void* storage);
+        // move constructs into dst and destroys src
+        void (*move)(void* dst, void* src);
+        void (*destroy)(void* storage);
+        bool inlined;
+    };
+    template <typename T>
+    static const Ops* inlineOps() {
+        static const Ops ops = {
+            [](void* s) { (*(T*)s)(); },
+            [](void* d, void* s) { new (d) T(std::move(*(T*)s)); ((T*)s)->~T(); },
+            [](void* s) { ((T*)s)->~T(); },
+            true
+        };
+        return &ops;
+    }
+    template <typename T>
+    static const Ops* heapOps() {
+        static const Ops ops = {
+            [](void* s) { (**(T**)s)(); },
+            [](void* d, void* s) { *(T**)d = *(T**)s; },
+            [](void* s) { delete *(T**)s; },
+            false
+        };
+        return &ops;
+    }
+    void moveFrom(TaskFunction& other) {
+        m_pOps = other.m_pOps;
+        if (m_pOps) {
+            m_pOps->move(m_storage, other.m_storage);
+            other.m_pOps = nullptr;
+        }
+    }
+
+    const Ops*                                  m_pOps = nullptr;
+    alignas(std::max_align_t) uint8_t           m_storage[INLINE_SIZE];
+};
+
+enum TaskPriority : uint8_t {
+    // state changes, run before anything else queued
+    TASK_PRIORITY_HIGH = 0,
+    TASK_PRIORITY_NORMAL,
+    // heavy work like loading assets, runs when nothing else waits
+    TASK_PRIORITY_LOW,
+    TASK_PRIORITY_COUNT
+};
+
+struct TaskExecutorStats {
+    uint32_t    posted = 0;
+    uint32_t    executed = 0;
+    // queue of the priority was full, task went to the spill list
+    uint32_t    spilled = 0;
+    // closures too big for the inline buffer, each one is a heap allocation
+    uint32_t    heapAllocs = 0;
+    uint16_t    depth = 0;
+    uint16_t    maxDepth = 0;
+    // post to start of execution, in us
+    uint64_t    totalLatency = 0;
+    uint32_t    maxLatency = 0;
+    uint32_t    avgLatency = 0;
+    // drains that ran out of budget with tasks left
+    uint32_t    overBudget = 0;
+};
+
+// Task queue for one consumer task, any task or timer callback may post.
+// One bounded lock free queue per priority (Vyukov style cells), tasks are moved
+// into preallocated cells so posting never touches the heap for inline closures.
+// A full queue spills into a mutex guarded list, so a post is never lost. While
+// anything is spilled new posts of that priority spill too, keeping them in order.
+class TaskExecutor {
+public:
+    // capacity per priority, rounded up to a power of two
+    TaskExecutor(const char* name, uint16_t capacity = 32);
+    // any task, never drops the task
+    void post(TaskFunction task, TaskPriority priority = TASK_PRIORITY_NORMAL);
+    // consumer only: runs tasks highest priority first until none is left or budgetUs is spent,
+    // at least one task runs. tasks posted while draining are picked up. true if tasks are left
+    bool drain(uint32_t budgetUs = UINT32_MAX);
+    bool empty() const;
+    const char* getName() const { return m_name; }
+    // read from another task, fine for a log line
+    TaskExecutorStats getStats() const;
+    void logStats() const;
+private:
+    struct Cell {
+        std::atomic<uint32_t>   seq{0};
+        int64_t                 enqueueTime = 0;
+        TaskFunction            task;
+    };
+    struct SpilledTask {
+        int64_t                 enqueueTime = 0;
+        TaskFunction            task;
+    };
+    struct Queue {
+        std::unique_ptr<Cell[]> cells;
+        // free running positions, producers claim with cas, the consumer owns dequeue
+        std::atomic<uint32_t>   enqueue{0};
+        std::atomic<uint32_t>   dequeue{0};
+        // overflow, runs after the cells
+        std::mutex              spillMutex;
+        std::deque<SpilledTask> spill;
+        std::atomic<uint32_t>   spillCount{0};
+    };
+    // false when the cells are full
+    bool tryEnqueue(Queue& queue, TaskFunction& task);
+    void spill(Queue& queue, TaskFunction&& task, TaskPriority priority);
+    // consumer only, runs the oldest task of the queue
+    bool runOne(Queue& queue);
+
+    const char*                 m_name;
+    uint32_t                    m_nMask;
+    Queue                       m_queues[TASK_PRIORITY_COUNT];
+    std::atomic<uint32_t>       m_nPosted{0};
+    std::atomic<uint32_t>       m_nSpilled{0};
+    std::atomic<uint32_t>       m_nHeapAllocs{0};
+    std::atomic<uint16_t>       m_nMaxDepth{0};
+    // consumer side
+    uint32_t                    m_nExecuted = 0;
+    uint64_t                    m_totalLatency = 0;
+    uint32_t                    m_maxLatency = 0;
+    uint32_t                    m_nOverBudget = 0;
+};
+
+#endif
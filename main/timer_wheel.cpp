@@ -0,0 +1,196 @@
+#include "timer_wheel.h"
+#include "esp_heap_caps.h"
+#include "utils/logger.h"
+
+TimerWheel::TimerWheel(uint16_t tickMs, uint16_t slotCount, uint16_t capacity)
+: m_nTickMs(tickMs), m_nodes(capacity), m_slots(slotCount, NONE) {
+    m_freeNodes.reserve(capacity);
+    for (int i = capacity - 1; i >= 0; i--) {
+        m_freeNodes.push_back(i);
+    }
+}
+
+TimerWheel::~TimerWheel() {
+    if (m_tickTimer) {
+        esp_timer_stop(m_tickTimer);
+        esp_timer_delete(m_tickTimer);
+    }
+}
+
+TimerWheel& TimerWheel::shared() {
+    static TimerWheel wheel;
+    return wheel;
+}
+
+void TimerWheel::start() {
+    if (m_tickTimer) {
+        return;
+    }
+    xTaskCreateWithCaps([](void* arg) {
+        auto wheel = (TimerWheel*)arg;
+        while (true) {
+            xTaskNotifyWait(0, UINT32_MAX, nullptr, portMAX_DELAY);
+            // no budget, nothing else runs on this task
+            wheel->m_worker.drain();
+        }
+    }, "timer worker", 1024 * 8, this, 3, &m_workerHandle, MALLOC_CAP_SPIRAM);
+    const esp_timer_create_args_t args = {
+        .callback = [](void* arg) {
+            ((TimerWheel*)arg)->tick();
+        },
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "timer wheel",
+        .skip_unhandled_events = true
+    };
+    auto err = esp_timer_create(&args, &m_tickTimer);
+    if (err != ESP_OK) {
+        LOGE("create timer wheel failed: %d\n", err);
+        return;
+    }
+    esp_timer_start_periodic(m_tickTimer, m_nTickMs * 1000);
+}
+
+TimerId TimerWheel::schedule(uint32_t delayMs, TaskFunction callback, uint32_t periodMs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_freeNodes.empty()) {
+        LOGE("timer wheel full, %zu timers\n", m_nodes.size());
+        return 0;
+    }
+    uint16_t index = m_freeNodes.back();
+    m_freeNodes.pop_back();
+    Node& node = m_nodes[index];
+    node.callback = std::move(callback);
+    node.periodTicks = periodMs ? (periodMs + m_nTickMs - 1) / m_nTickMs : 0;
+    link(index, (delayMs + m_nTickMs - 1) / m_nTickMs);
+    return makeId(index, node.generation);
+}
+
+bool TimerWheel::cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint16_t index;
+    Node* node = lookup(id, &index);
+    if (!node) {
+        return false;
+    }
+    if (node->state == NODE_WAITING) {
+        unlink(index);
+    }
+    // a queued run finds the generation changed and does nothing
+    release(index);
+    return true;
+}
+
+TimerWheel::Node* TimerWheel::lookup(TimerId id, uint16_t* index) {
+    uint16_t i = (id & 0xFFFF) - 1;
+    if (!id || i >= m_nodes.size()) {
+        return nullptr;
+    }
+    Node& node = m_nodes[i];
+    if (node.state == NODE_FREE || node.generation != (id >> 16)) {
+        return nullptr;
+    }
+    *index = i;
+    return &node;
+}
+
+void TimerWheel::link(uint16_t index, uint32_t ticks) {
+    // expires on the next tick at the earliest
+    if (ticks == 0) {
+        ticks = 1;
+    }
+    uint32_t slotCount = m_slots.size();
+    Node& node = m_nodes[index];
+    node.slot = (m_nCurrentSlot + ticks) % slotCount;
+    // the slot is visited once per turn, the first visit is after ticks % slotCount steps
+    node.rounds = (ticks - 1) / slotCount;
+    node.state = NODE_WAITING;
+    node.prev = NONE;
+    node.next = m_slots[node.slot];
+    if (node.next != NONE) {
+        m_nodes[node.next].prev = index;
+    }
+    m_slots[node.slot] = index;
+}
+
+void TimerWheel::unlink(uint16_t index) {
+    Node& node = m_nodes[index];
+    if (node.prev != NONE) {
+        m_nodes[node.prev].next = node.next;
+    } else {
+        m_slots[node.slot] = node.next;
+    }
+    if (node.next != NONE) {
+        m_nodes[node.next].prev = node.prev;
+    }
+    node.prev = NONE;
+    node.next = NONE;
+}
+
+void TimerWheel::release(uint16_t index) {
+    Node& node = m_nodes[index];
+    node.callback.reset();
+    node.state = NODE_FREE;
+    node.generation++;
+    m_freeNodes.push_back(index);
+}
+
+void TimerWheel::tick() {
+    bool fired = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_nCurrentSlot = (m_nCurrentSlot + 1) % m_slots.size();
+        uint16_t index = m_slots[m_nCurrentSlot];
+        while (index != NONE) {
+            Node& node = m_nodes[index];
+            uint16_t next = node.next;
+            if (node.rounds) {
+                node.rounds--;
+            } else {
+                unlink(index);
+                if (node.periodTicks) {
+                    link(index, node.periodTicks);
+                } else {
+                    node.state = NODE_FIRED;
+                }
+                TimerId id = makeId(index, node.generation);
+                m_worker.post([this, id]() {
+                    run(id);
+                });
+                fired = true;
+            }
+            index = next;
+        }
+    }
+    if (fired && m_workerHandle) {
+        xTaskNotify(m_workerHandle, 1, eSetBits);
+    }
+}
+
+void TimerWheel::run(TimerId id) {
+    TaskFunction callback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint16_t index;
+        Node* node = lookup(id, &index);
+        if (!node) {
+            return;
+        }
+        callback = std::move(node->callback);
+        if (node->state == NODE_FIRED) {
+            release(index);
+        }
+    }
+    // a periodic timer that is still running when it expires again skips that run
+    if (!callback) {
+        return;
+    }
+    // not under the lock, the callback may schedule or cancel timers
+    callback();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    uint16_t index;
+    Node* node = lookup(id, &index);
+    if (node && node->state == NODE_WAITING) {
+        node->callback = std::move(callback);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_timer.h"
+#include "task_executor.h"
+
+// 0 is never a valid timer
+using TimerId = uint32_t;
+
+// Hashed timer wheel driven by one periodic esp_timer. Timer nodes come from a fixed pool,
+// schedule and cancel are O(1). The esp_timer callback only moves expired timers onto the
+// worker executor, callbacks run on the "timer worker" task so a slow one (reconnect, sleep)
+// never holds up other esp_timers like the lvgl tick.
+class TimerWheel {
+public:
+    TimerWheel(uint16_t tickMs = 100, uint16_t slotCount = 256, uint16_t capacity = 32);
+    ~TimerWheel();
+    static TimerWheel& shared();
+    // creates the tick timer and the worker task, timers scheduled before run from then on
+    void start();
+    // any task. callback runs once after delayMs, then every periodMs if that is not 0.
+    // returns 0 when the pool is used up
+    TimerId schedule(uint32_t delayMs, TaskFunction callback, uint32_t periodMs = 0);
+    // any task. false if the timer already fired (one shot) or was cancelled
+    bool cancel(TimerId id);
+    const TaskExecutor& getExecutor() const { return m_worker; }
+private:
+    static constexpr uint16_t NONE = 0xFFFF;
+    enum NodeState : uint8_t {
+        NODE_FREE = 0,
+        // linked in a wheel slot
+        NODE_WAITING,
+        // one shot that expired, its run is queued on the worker
+        NODE_FIRED
+    };
+    struct Node {
+        TaskFunction    callback;
+        uint32_t        periodTicks = 0;
+        // full wheel turns left before it expires
+        uint32_t        rounds = 0;
+        uint16_t        prev = NONE;
+        uint16_t        next = NONE;
+        uint16_t        slot = 0;
+        // bumped on every reuse, stale ids don't match
+        uint16_t        generation = 0;
+        NodeState       state = NODE_FREE;
+    };
+    static TimerId makeId(uint16_t index, uint16_t generation) { return ((uint32_t)generation << 16) | (index + 1); }
+    // null if the id is stale
+    Node* lookup(TimerId id, uint16_t* index);
+    void link(uint16_t index, uint32_t ticks);
+    void unlink(uint16_t index);
+    void release(uint16_t index);
+    // esp_timer task, one wheel step
+    void tick();
+    // worker task
+    void run(TimerId id);
+
+    uint16_t                    m_nTickMs;
+    std::vector<Node>           m_nodes;
+    std::vector<uint16_t>       m_slots;
+    std::vector<uint16_t>       m_freeNodes;
+    uint32_t                    m_nCurrentSlot = 0;
+    std::mutex                  m_mutex;
+    esp_timer_handle_t          m_tickTimer = nullptr;
+    TaskHandle_t                m_workerHandle = nullptr;
+    TaskExecutor                m_worker{"timer"};
+};
+
+#endif
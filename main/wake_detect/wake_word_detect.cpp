@@ -2,20 +2,35 @@
 #include "opus_encoder.h"
 #include "esp_timer.h"
 #include "utils/logger.h"
+#include "core/memory_allocator.h"
+#include <string.h>
+
+// frames louder than noise floor times this count as speech
+#define ONSET_SNR 4.0f
+// below this mean square a frame is silence whatever the floor
+#define ONSET_MIN_ENERGY 10000
+// silent frames tolerated inside the wake word
+#define ONSET_MAX_GAP 3
+// frames kept in front of the onset
+#define ONSET_MARGIN 1
 
 
 WakeWordDetect::WakeWordDetect() {
     event_group_ = xEventGroupCreate();
+    pcm_ring_ = (int16_t*)psram_prefered_malloc(WAKE_WORD_PREROLL_FRAMES * WAKE_WORD_FRAME_SAMPLES * sizeof(int16_t));
+    opus_ring_ = (OpusSlot*)psram_prefered_malloc(WAKE_WORD_PREROLL_FRAMES * sizeof(OpusSlot));
+    prepared_ = (OpusSlot*)psram_prefered_malloc(WAKE_WORD_PREROLL_FRAMES * sizeof(OpusSlot));
 }
 
 WakeWordDetect::~WakeWordDetect() {
-    if (wake_word_encode_task_stack_ != nullptr) {
-        heap_caps_free(wake_word_encode_task_stack_);
-    }
+    free(pcm_ring_);
+    free(opus_ring_);
+    free(prepared_);
     vEventGroupDelete(event_group_);
 }
 
 void WakeWordDetect::StartDetection() {
+    preroll_reset_ = true;
     xEventGroupSetBits(event_group_, DETECTION_RUNNING_EVENT);
 }
 
@@ -31,45 +46,111 @@ void WakeWordDetect::OnWakeWordDetected(std::function<void(const std::string& wa
     wake_word_detected_callback_ = callback;
 }
 
-void WakeWordDetect::EncodeWakeWordData() {
-    wake_word_opus_.clear();
-    if (wake_word_encode_task_stack_ == nullptr) {
-        wake_word_encode_task_stack_ = (StackType_t*)heap_caps_malloc(4096 * 8, MALLOC_CAP_SPIRAM);
+void WakeWordDetect::StoreWakeWordData(const int16_t* data, size_t samples) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    if (preroll_reset_.exchange(false)) {
+        // audio before the last stop is not contiguous with what comes now
+        pcm_written_ = 0;
+        opus_written_ = 0;
+        if (preroll_encoder_)
+            preroll_encoder_->ResetState();
     }
-    wake_word_encode_task_ = xTaskCreateStatic([](void* arg) {
-        auto this_ = (WakeWordDetect*)arg;
-        {
-            auto start_time = esp_timer_get_time();
-            auto encoder = std::make_unique<OpusEncoderWrapper>(16000, 1, OPUS_FRAME_DURATION_MS);
-            encoder->SetComplexity(0); // 0 is the fastest
+    const size_t ringSamples = WAKE_WORD_PREROLL_FRAMES * WAKE_WORD_FRAME_SAMPLES;
+    while (samples > 0) {
+        size_t pos = pcm_written_ % ringSamples;
+        size_t frameLeft = WAKE_WORD_FRAME_SAMPLES - pos % WAKE_WORD_FRAME_SAMPLES;
+        size_t n = samples < frameLeft ? samples : frameLeft;
+        memcpy(pcm_ring_ + pos, data, n * sizeof(int16_t));
+        pcm_written_ += n;
+        data += n;
+        samples -= n;
+        if (n == frameLeft) {
+            EncodePrerollFrame(pcm_ring_ + pos + n - WAKE_WORD_FRAME_SAMPLES);
+        }
+    }
+}
 
-            for (auto& pcm: this_->wake_word_pcm_) {
-                encoder->Encode(std::move(pcm), [this_](std::vector<uint8_t>&& opus) {
-                    std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-                    this_->wake_word_opus_.emplace_back(std::move(opus));
-                    this_->wake_word_cv_.notify_all();
-                });
-            }
-            this_->wake_word_pcm_.clear();
+void WakeWordDetect::EncodePrerollFrame(const int16_t* pcm) {
+    if (!preroll_encoder_) {
+        preroll_encoder_ = std::make_unique<OpusEncoderWrapper>(WAKE_WORD_SAMPLE_RATE, 1, WAKE_WORD_FRAME_DURATION_MS);
+        preroll_encoder_->SetComplexity(0); // 0 is the fastest
+    }
+    uint64_t sum = 0;
+    for (size_t i = 0; i < WAKE_WORD_FRAME_SAMPLES; i++) {
+        sum += (int32_t)pcm[i] * pcm[i];
+    }
+    uint32_t energy = sum / WAKE_WORD_FRAME_SAMPLES;
+    // floor follows quiet frames right away and loud ones slowly
+    if (energy < noise_floor_ || noise_floor_ == 0)
+        noise_floor_ = energy;
+    else
+        noise_floor_ += (energy - noise_floor_) / 64;
 
-            auto end_time = esp_timer_get_time();
-            LOGI("Encode wake word opus %zu packets in %lld ms",
-                this_->wake_word_opus_.size(), (end_time - start_time) / 1000);
+    OpusSlot& slot = opus_ring_[opus_written_ % WAKE_WORD_PREROLL_FRAMES];
+    slot.len = 0;
+    slot.energy = energy;
+    // exactly one frame in, exactly one packet out
+    preroll_encoder_->Encode(std::vector<int16_t>(pcm, pcm + WAKE_WORD_FRAME_SAMPLES), [&slot](std::vector<uint8_t>&& opus) {
+        if (opus.size() <= WAKE_WORD_OPUS_SLOT_SIZE) {
+            memcpy(slot.data, opus.data(), opus.size());
+            slot.len = opus.size();
+        }
+    });
+    opus_written_++;
+}
 
-            std::lock_guard<std::mutex> lock(this_->wake_word_mutex_);
-            this_->wake_word_opus_.push_back(std::vector<uint8_t>());
-            this_->wake_word_cv_.notify_all();
+size_t WakeWordDetect::FindOnset(size_t first, size_t end) {
+    float threshold = noise_floor_ * ONSET_SNR;
+    if (threshold < ONSET_MIN_ENERGY)
+        threshold = ONSET_MIN_ENERGY;
+    auto isSpeech = [this, threshold](size_t frame) {
+        return opus_ring_[frame % WAKE_WORD_PREROLL_FRAMES].energy > threshold;
+    };
+    // detection fires a little after the wake word ends, skip the trailing silence
+    size_t i = end;
+    while (i > first && !isSpeech(i - 1))
+        i--;
+    if (i == first) {
+        // nothing stands out, send all of it
+        return first;
+    }
+    // then walk back through the word, short pauses between syllables included
+    size_t onset = i - 1;
+    size_t gap = 0;
+    for (size_t j = onset; j > first; j--) {
+        if (isSpeech(j - 1)) {
+            onset = j - 1;
+            gap = 0;
+        } else if (++gap > ONSET_MAX_GAP) {
+            break;
         }
-        vTaskDelete(NULL);
-    }, "encode_detect_packets", 4096 * 8, this, 2, wake_word_encode_task_stack_, &wake_word_encode_task_buffer_);
+    }
+    return onset > first + ONSET_MARGIN ? onset - ONSET_MARGIN : first;
+}
+
+size_t WakeWordDetect::PrepareWakeWordOpus(bool trimToOnset) {
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    size_t end = opus_written_;
+    size_t oldest = end > WAKE_WORD_PREROLL_FRAMES ? end - WAKE_WORD_PREROLL_FRAMES : 0;
+    size_t first = trimToOnset ? FindOnset(oldest, end) : oldest;
+    prepared_count_ = 0;
+    prepared_read_ = 0;
+    for (size_t i = first; i < end; i++) {
+        const OpusSlot& slot = opus_ring_[i % WAKE_WORD_PREROLL_FRAMES];
+        if (slot.len == 0)
+            continue;
+        memcpy(&prepared_[prepared_count_++], &slot, offsetof(OpusSlot, data) + slot.len);
+    }
+    LOGI("Wake word pre-roll %zu of %zu frames\n", prepared_count_, end - oldest);
+    return prepared_count_;
 }
 
 bool WakeWordDetect::GetWakeWordOpus(std::vector<uint8_t>& opus) {
-    std::unique_lock<std::mutex> lock(wake_word_mutex_);
-    wake_word_cv_.wait(lock, [this]() {
-        return !wake_word_opus_.empty();
-    });
-    opus.swap(wake_word_opus_.front());
-    wake_word_opus_.pop_front();
-    return !opus.empty();
+    std::lock_guard<std::mutex> lock(wake_word_mutex_);
+    if (prepared_read_ >= prepared_count_) {
+        return false;
+    }
+    const OpusSlot& slot = prepared_[prepared_read_++];
+    opus.assign(slot.data, slot.data + slot.len);
+    return true;
 }
@@ -10,45 +10,73 @@
 #include <esp_afe_sr_models.h>
 #include <esp_nsn_models.h>
 
-#include <list>
+#include <memory>
 #include <mutex>
-#include <condition_variable>
+#include <atomic>
 
-#define OPUS_FRAME_DURATION_MS 60
+// pre-roll granularity, opus packets carry their own duration so it needn't match the uplink
+#define WAKE_WORD_FRAME_DURATION_MS 60
 #define DETECTION_RUNNING_EVENT 1
+#define WAKE_WORD_SAMPLE_RATE 16000
+#define WAKE_WORD_FRAME_SAMPLES (WAKE_WORD_SAMPLE_RATE / 1000 * WAKE_WORD_FRAME_DURATION_MS)
+// about 2 seconds of pre-roll, whole frames so a frame never wraps in the pcm ring
+#define WAKE_WORD_PREROLL_FRAMES 34
+#define WAKE_WORD_OPUS_SLOT_SIZE 512
+
+class OpusEncoderWrapper;
+class AudioFrontEnd;
 
 class WakeWordDetect {
 public:
     WakeWordDetect();
     virtual ~WakeWordDetect();
-    virtual void Initialize(int channels, bool reference) = 0;
-    virtual void Feed(const std::vector<int16_t>& data) = 0;
+    // detection runs on the shared front end, which is fed by the owner
+    virtual void Initialize(AudioFrontEnd* front_end) = 0;
 
     virtual void StartDetection();
     virtual void StopDetection();
     bool IsDetectionRunning();
     void OnWakeWordDetected(std::function<void(const std::string& wake_word)> callback) ;
+    // Snapshot the pre-encoded pre-roll for GetWakeWordOpus, optionally trimmed to the speech onset.
+    // Frames are already encoded while detection runs, so this only copies them. returns frame count
+    size_t PrepareWakeWordOpus(bool trimToOnset = true);
+    // next prepared frame, false when all are taken
     bool GetWakeWordOpus(std::vector<uint8_t>& opus);
     const std::string& GetLastDetectedWakeWord() const { return last_detected_wake_word_; }
-    void EncodeWakeWordData();
 protected:
+    // called by the front end task with every processed chunk while detection runs
+    void StoreWakeWordData(const int16_t* data, size_t samples);
+
     char* wakenet_model_ = NULL;
     std::vector<std::string> wake_words_;
-    std::vector<int16_t> input_buffer_;
     EventGroupHandle_t event_group_;
     std::function<void(const std::string& wake_word)> wake_word_detected_callback_;
-    int channels_;
-    bool reference_;
     std::string last_detected_wake_word_;
+private:
+    struct OpusSlot {
+        uint16_t len;
+        // mean square of the frame's pcm, used to find the speech onset
+        uint32_t energy;
+        uint8_t data[WAKE_WORD_OPUS_SLOT_SIZE];
+    };
+    void EncodePrerollFrame(const int16_t* pcm);
+    size_t FindOnset(size_t first, size_t end);
 
-    TaskHandle_t wake_word_encode_task_ = nullptr;
-    StaticTask_t wake_word_encode_task_buffer_;
-    StackType_t* wake_word_encode_task_stack_ = nullptr;
-    std::list<std::vector<int16_t>> wake_word_pcm_;
-    std::list<std::vector<uint8_t>> wake_word_opus_;
+    // pcm and opus rings run in parallel, opus slot i holds pcm frame i
+    int16_t* pcm_ring_ = nullptr;
+    OpusSlot* opus_ring_ = nullptr;
+    // total samples / frames written, ring position is the remainder
+    size_t pcm_written_ = 0;
+    size_t opus_written_ = 0;
+    float noise_floor_ = 0;
+    std::unique_ptr<OpusEncoderWrapper> preroll_encoder_;
+    // set by StartDetection, detection task drops the stale pre-roll on its next chunk
+    std::atomic<bool> preroll_reset_{true};
+    // frames copied out by PrepareWakeWordOpus
+    OpusSlot* prepared_ = nullptr;
+    size_t prepared_count_ = 0;
+    size_t prepared_read_ = 0;
     std::mutex wake_word_mutex_;
-    std::condition_variable wake_word_cv_;
-
 };
 
 #endif
@@ -4,18 +4,14 @@
 
 class WakeWordDetectAFE : public WakeWordDetect {
 public:
-    ~WakeWordDetectAFE();
-
-    void Initialize(int channels, bool reference) override;
-    void Feed(const std::vector<int16_t>& data) override;
+    void Initialize(AudioFrontEnd* front_end) override;
 
+    void StartDetection() override;
     void StopDetection() override;
 private:
-    esp_afe_sr_iface_t* afe_iface_ = nullptr;
-    esp_afe_sr_data_t* afe_data_ = nullptr;
+    AudioFrontEnd* front_end_ = nullptr;
 
-    void StoreWakeWordData(uint16_t* data, size_t size);
-    void AudioDetectionTask();
+    void OnFetch(const afe_fetch_result_t* res);
 };
 
 #endif
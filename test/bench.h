@@ -0,0 +1,40 @@
+#ifndef _HOST_BENCH_H_
+#define _HOST_BENCH_H_
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+
+// host numbers only compare implementations with each other, the device is far slower
+
+// keeps a result alive so the measured work isn't optimized away
+template <typename T>
+inline void benchKeep(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// runs fn until minMs have passed, ns per call
+template <typename F>
+double benchNs(F&& fn, uint32_t minMs = 200) {
+    using Clock = std::chrono::steady_clock;
+    // warm up caches and lazily allocated buffers
+    fn();
+    uint64_t calls = 0;
+    auto start = Clock::now();
+    auto end = start + std::chrono::milliseconds(minMs);
+    Clock::time_point now;
+    do {
+        for (int i = 0; i < 8; i++) {
+            fn();
+        }
+        calls += 8;
+        now = Clock::now();
+    } while (now < end);
+    return std::chrono::duration<double, std::nano>(now - start).count() / calls;
+}
+
+// one line per case, speedup of the new implementation over the legacy one
+inline void benchReport(const char* name, double legacyNs, double newNs) {
+    printf("%-40s legacy %12.1f ns  new %12.1f ns  x%.2f\n", name, legacyNs, newNs, legacyNs / newNs);
+}
+
+#endif
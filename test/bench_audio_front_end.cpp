@@ -0,0 +1,68 @@
+#include "audio_processing/audio_front_end.h"
+#include "fake_esp_sr.h"
+#include "bench.h"
+#include "test.h"
+#include <vector>
+
+#define CHANNELS 2
+
+// WakeWordDetectAFE::Feed before AudioFrontEnd: appends the block to a vector, feeds from
+// its head and shifts the rest down after every chunk
+class LegacyFeed {
+public:
+    LegacyFeed(esp_afe_sr_iface_t* iface, esp_afe_sr_data_t* data, int channels)
+        : afe_iface_(iface), afe_data_(data), channels_(channels) {}
+
+    void Feed(const std::vector<int16_t>& data) {
+        input_buffer_.insert(input_buffer_.end(), data.begin(), data.end());
+
+        auto feed_size = afe_iface_->get_feed_chunksize(afe_data_) * channels_;
+        while (input_buffer_.size() >= (size_t)feed_size) {
+            afe_iface_->feed(afe_data_, input_buffer_.data());
+            input_buffer_.erase(input_buffer_.begin(), input_buffer_.begin() + feed_size);
+        }
+    }
+
+private:
+    esp_afe_sr_iface_t* afe_iface_;
+    esp_afe_sr_data_t* afe_data_;
+    int channels_;
+    std::vector<int16_t> input_buffer_;
+};
+
+// the same number of samples through both, ns per mic block
+static void run(const char* name, AudioFrontEnd* frontEnd, LegacyFeed& legacy, size_t blockSamples) {
+    std::vector<int16_t> block(blockSamples);
+    for (size_t i = 0; i < block.size(); i++) {
+        block[i] = (int16_t)i;
+    }
+    auto& feeds = fakeAfeFeeds();
+    double legacyNs = benchNs([&]() {
+        legacy.Feed(block);
+    });
+    int before = feeds.count;
+    double newNs = benchNs([&]() {
+        frontEnd->Feed(block.data(), block.size());
+    });
+    CHECK(blockSamples < FAKE_AFE_FEED_CHUNK * CHANNELS || feeds.count > before);
+    benchReport(name, legacyNs, newNs);
+}
+
+// mic blocks as the audio task reads them, 16kHz stereo interleaved
+int main() {
+    auto& feeds = fakeAfeFeeds();
+    feeds.channels = CHANNELS;
+    // its fetch task never exits, so the front end is never destroyed
+    auto frontEnd = new AudioFrontEnd();
+    frontEnd->Initialize(CHANNELS, true);
+    esp_afe_sr_iface_t* iface = esp_afe_handle_from_config(nullptr);
+    LegacyFeed legacy(iface, iface->create_from_config(nullptr), CHANNELS);
+    run("10ms block, 320 samples", frontEnd, legacy, 160 * CHANNELS);
+    run("20ms block, 640 samples", frontEnd, legacy, 320 * CHANNELS);
+    run("one feed chunk, 1024 samples", frontEnd, legacy, FAKE_AFE_FEED_CHUNK * CHANNELS);
+    run("60ms block, 1920 samples", frontEnd, legacy, 960 * CHANNELS);
+    run("odd block, 1500 samples", frontEnd, legacy, 1500);
+    run("4 chunks, 4096 samples", frontEnd, legacy, 4 * FAKE_AFE_FEED_CHUNK * CHANNELS);
+    benchKeep(feeds.checksum);
+    return 0;
+}
@@ -0,0 +1,199 @@
+#include "socket/frame_reassembler.h"
+#include "bench.h"
+#include "test.h"
+#include <string.h>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <vector>
+
+// recv side of the tcp stream: the bytes and how recv split them
+struct Capture {
+    const char*             name = "";
+    std::vector<uint8_t>    stream;
+    std::vector<size_t>     chunks;
+    size_t                  frames = 0;
+};
+
+#define LEGACY_RECV_BUFF_SIZE 1024 * 32
+// lwip hands out one segment per pbuf, recv returns a few of them at once
+#define TCP_MSS 1436
+
+// ProtoSocket::onDataReceived before FrameReassembler, without the decode. copies every
+// chunk into a fixed buffer and shifts the tail down after each frame
+class LegacyReassembler {
+public:
+    bool feed(const uint8_t* data, size_t len, const FrameReassembler::FrameCallback& onFrame) {
+        // asserted on the device
+        if (m_nDataLen + len > LEGACY_RECV_BUFF_SIZE) {
+            return false;
+        }
+        memcpy(m_buffer + m_nDataLen, data, len);
+        m_nDataLen += len;
+        if (m_nDataLen <= 4) {
+            return true;
+        }
+        size_t protocolLen = readLen(m_buffer);
+        size_t packetLen = protocolLen + 4;
+        while (m_nDataLen >= packetLen) {
+            onFrame(m_buffer + 4, protocolLen);
+            m_nDataLen -= packetLen;
+            memmove(m_buffer, m_buffer + packetLen, m_nDataLen);
+            protocolLen = readLen(m_buffer);
+            packetLen = protocolLen + 4;
+        }
+        return true;
+    }
+private:
+    static size_t readLen(const uint8_t* data) {
+        return ((size_t)data[0] << 24) | ((size_t)data[1] << 16) | ((size_t)data[2] << 8) | data[3];
+    }
+
+    uint8_t m_buffer[LEGACY_RECV_BUFF_SIZE];
+    size_t  m_nDataLen = 0;
+};
+
+static void appendFrame(Capture& capture, size_t len, std::mt19937& rng) {
+    capture.stream.push_back(len >> 24);
+    capture.stream.push_back(len >> 16);
+    capture.stream.push_back(len >> 8);
+    capture.stream.push_back(len);
+    for (size_t i = 0; i < len; i++) {
+        capture.stream.push_back(rng());
+    }
+    capture.frames++;
+}
+
+// recv returns between one and maxSegments segments
+static void splitSegments(Capture& capture, std::mt19937& rng, int maxSegments) {
+    size_t pos = 0;
+    while (pos < capture.stream.size()) {
+        size_t len = std::min<size_t>(TCP_MSS * (1 + rng() % maxSegments), capture.stream.size() - pos);
+        capture.chunks.push_back(len);
+        pos += len;
+    }
+}
+
+// tts faster than realtime: a burst of 60ms opus messages, several per recv
+static Capture ttsBurst() {
+    Capture capture;
+    capture.name = "tts burst, 1-4 segments per recv";
+    std::mt19937 rng(1);
+    for (int i = 0; i < 500; i++) {
+        appendFrame(capture, 100 + rng() % 80, rng);
+    }
+    splitSegments(capture, rng, 4);
+    return capture;
+}
+
+// realtime tts, every opus message arrives on its own
+static Capture ttsPaced() {
+    Capture capture;
+    capture.name = "tts paced, one message per recv";
+    std::mt19937 rng(2);
+    for (int i = 0; i < 500; i++) {
+        size_t start = capture.stream.size();
+        appendFrame(capture, 100 + rng() % 80, rng);
+        capture.chunks.push_back(capture.stream.size() - start);
+    }
+    return capture;
+}
+
+// mcp tool lists and configs, json messages of several segments
+static Capture mcpJson() {
+    Capture capture;
+    capture.name = "mcp json 4-24KB, 1 segment per recv";
+    std::mt19937 rng(3);
+    for (int i = 0; i < 20; i++) {
+        appendFrame(capture, 4096 + rng() % 20480, rng);
+    }
+    splitSegments(capture, rng, 1);
+    return capture;
+}
+
+// a tool list bigger than the legacy 32KB buffer
+static Capture mcpLarge() {
+    Capture capture;
+    capture.name = "mcp json 48KB, 1-4 segments per recv";
+    std::mt19937 rng(4);
+    for (int i = 0; i < 4; i++) {
+        appendFrame(capture, 48 * 1024, rng);
+    }
+    splitSegments(capture, rng, 4);
+    return capture;
+}
+
+// one recv callback chunk per record: 4 byte big endian length, then the bytes
+static bool loadCapture(const char* path, Capture& capture) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    capture.name = path;
+    uint8_t header[4];
+    while (fread(header, 1, 4, file) == 4) {
+        size_t len = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | header[3];
+        size_t pos = capture.stream.size();
+        capture.stream.resize(pos + len);
+        if (fread(capture.stream.data() + pos, 1, len, file) != len) {
+            break;
+        }
+        capture.chunks.push_back(len);
+    }
+    fclose(file);
+    return !capture.chunks.empty();
+}
+
+template <typename Reassembler>
+static bool replay(Reassembler& reassembler, const Capture& capture, size_t* frames) {
+    const uint8_t* data = capture.stream.data();
+    *frames = 0;
+    for (size_t len : capture.chunks) {
+        if (!reassembler.feed(data, len, [frames](const uint8_t* frame, size_t) {
+            benchKeep(frame);
+            (*frames)++;
+        })) {
+            return false;
+        }
+        data += len;
+    }
+    return true;
+}
+
+static void run(const Capture& capture) {
+    FrameReassembler reassembler;
+    size_t frames = 0;
+    CHECK(replay(reassembler, capture, &frames));
+    CHECK(!capture.frames || frames == capture.frames);
+    double newNs = benchNs([&]() {
+        replay(reassembler, capture, &frames);
+    });
+    auto legacy = std::make_unique<LegacyReassembler>();
+    size_t legacyFrames = 0;
+    if (!replay(*legacy, capture, &legacyFrames)) {
+        // a frame over 32KB, the device asserted
+        printf("%-40s legacy overflows  new %12.1f ns\n", capture.name, newNs);
+        return;
+    }
+    CHECK(legacyFrames == frames);
+    double legacyNs = benchNs([&]() {
+        replay(*legacy, capture, &legacyFrames);
+    });
+    benchReport(capture.name, legacyNs, newNs);
+}
+
+// replays each capture through the legacy and the new reassembler, ns per capture.
+// a capture recorded on the device can be passed as the argument
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        Capture capture;
+        CHECK(loadCapture(argv[1], capture));
+        run(capture);
+        return 0;
+    }
+    run(ttsBurst());
+    run(ttsPaced());
+    run(mcpJson());
+    run(mcpLarge());
+    return 0;
+}
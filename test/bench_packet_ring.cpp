@@ -0,0 +1,143 @@
+#include "big_mouth_ai/packet_ring.h"
+#include "bench.h"
+#include "test.h"
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+// 60ms opus frames at the bitrates the server uses
+#define PACKET_SIZE 160
+// what the jitter buffer ring holds, 12s of tts
+#define RING_SLOTS 200
+
+static std::atomic<uint64_t> s_allocs{0};
+
+// counts heap allocations, gcc can't tell the replaced new and delete pair up
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void* operator new(size_t size) {
+    s_allocs.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// the downlink queue before PacketRing: a vector per packet in a list, under a recursive mutex.
+// the audio task checked empty() without the lock
+class LegacyQueue {
+public:
+    void push(const uint8_t* data, size_t len) {
+        std::lock_guard<std::recursive_mutex> lock(m_mutex);
+        m_queue.emplace_back(std::vector<uint8_t>(data, data + len));
+    }
+    bool pop(std::vector<uint8_t>& out) {
+        if (m_queue.empty()) {
+            return false;
+        }
+        std::unique_lock<std::recursive_mutex> lock(m_mutex);
+        out = std::move(m_queue.front());
+        m_queue.pop_front();
+        return true;
+    }
+private:
+    std::list<std::vector<uint8_t>> m_queue;
+    std::recursive_mutex            m_mutex;
+};
+
+// the consumer hands the packet to the decoder, both sides copy it once
+class RingQueue {
+public:
+    bool push(const uint8_t* data, size_t len) { return m_ring.push(data, len); }
+    bool pop(std::vector<uint8_t>& out) {
+        size_t len = 0;
+        const uint8_t* data = m_ring.front(&len);
+        if (!data) {
+            return false;
+        }
+        out.assign(data, data + len);
+        m_ring.pop();
+        return true;
+    }
+private:
+    PacketRing m_ring{RING_SLOTS, 1024};
+};
+
+// realtime playback: one packet in, one packet out. allocations per packet in allocs
+template <typename Queue>
+static double pushPop(Queue& queue, const uint8_t* packet, double* allocs) {
+    std::vector<uint8_t> out;
+    out.reserve(1024);
+    auto pushPopOne = [&]() {
+        queue.push(packet, PACKET_SIZE);
+        queue.pop(out);
+    };
+    pushPopOne();
+    uint64_t before = s_allocs;
+    for (int i = 0; i < 1000; i++) {
+        pushPopOne();
+    }
+    *allocs = (s_allocs - before) / 1000.0;
+    return benchNs(pushPopOne);
+}
+
+// a whole tts reply arrives faster than realtime while the audio task keeps popping,
+// ns per packet with both sides on their own thread
+template <typename Queue>
+static double burst(Queue& queue, const uint8_t* packet) {
+    return benchNs([&]() {
+        std::thread consumer([&]() {
+            std::vector<uint8_t> out;
+            out.reserve(1024);
+            for (int popped = 0; popped < RING_SLOTS;) {
+                if (queue.pop(out)) {
+                    popped++;
+                } else {
+                    std::this_thread::yield();
+                }
+            }
+        });
+        for (int i = 0; i < RING_SLOTS; i++) {
+            while (!queue.push(packet, PACKET_SIZE)) {
+                std::this_thread::yield();
+            }
+        }
+        consumer.join();
+    }) / RING_SLOTS;
+}
+
+// legacy push never fails, give it the same signature
+struct LegacyAdapter {
+    LegacyQueue queue;
+    bool push(const uint8_t* data, size_t len) {
+        queue.push(data, len);
+        return true;
+    }
+    bool pop(std::vector<uint8_t>& out) { return queue.pop(out); }
+};
+
+int main() {
+    uint8_t packet[PACKET_SIZE] = {0};
+    LegacyAdapter legacy;
+    RingQueue ring;
+    double legacyAllocs = 0;
+    double ringAllocs = 0;
+    double legacyNs = pushPop(legacy, packet, &legacyAllocs);
+    double ringNs = pushPop(ring, packet, &ringAllocs);
+    benchReport("push+pop 160B packet", legacyNs, ringNs);
+    printf("heap allocations per packet: legacy %.1f new %.1f\n", legacyAllocs, ringAllocs);
+    // steady state never touches the heap
+    CHECK(ringAllocs == 0);
+    benchReport("200 packet burst, ns per packet", burst(legacy, packet), burst(ring, packet));
+    return 0;
+}
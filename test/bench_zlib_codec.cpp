@@ -0,0 +1,150 @@
+#include "socket/zlib_codec.h"
+#include "bench.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// defl and infl of the removed socket/compress.h, each call sets up and tears down a
+// whole zlib stream with default window and memory level
+static uint8_t* legacyDefl(const uint8_t* source, size_t src_len, size_t* out_len, int level) {
+    int ret;
+    unsigned have;
+    z_stream strm;
+    int out_buf_len = src_len + 16;
+    *out_len = 0;
+    unsigned char* out = (unsigned char*)malloc(out_buf_len);
+    if (!out) {
+        return nullptr;
+    }
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    ret = deflateInit(&strm, level);
+    if (ret != Z_OK)
+        return nullptr;
+    strm.avail_in = src_len;
+    strm.next_in = (unsigned char*)source;
+    do {
+        strm.avail_out = out_buf_len;
+        strm.next_out = out;
+        ret = deflate(&strm, Z_FINISH);
+        have = out_buf_len - strm.avail_out;
+        *out_len += have;
+    } while (strm.avail_out == 0);
+    (void)deflateEnd(&strm);
+    return out;
+}
+
+#define MAX_DEC_CACHE_LEN  1024 * 32
+static uint8_t* legacyInfl(const uint8_t* source, size_t src_len, size_t* out_len) {
+    int ret;
+    unsigned have;
+    z_stream strm;
+    *out_len = 0;
+    int out_buf_len = src_len * 3;
+    if (out_buf_len > MAX_DEC_CACHE_LEN) {
+        out_buf_len = MAX_DEC_CACHE_LEN;
+    }
+    unsigned char* out = (unsigned char*)malloc(out_buf_len);
+    if (!out) {
+        return nullptr;
+    }
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    ret = inflateInit(&strm);
+    if (ret != Z_OK)
+        return nullptr;
+    do {
+        strm.avail_in = src_len;
+        if (strm.avail_in == 0)
+            break;
+        strm.next_in = (unsigned char*)source;
+        do {
+            strm.avail_out = out_buf_len;
+            strm.next_out = out;
+            ret = inflate(&strm, Z_NO_FLUSH);
+            switch (ret) {
+            case Z_NEED_DICT:
+            case Z_DATA_ERROR:
+            case Z_MEM_ERROR:
+                (void)inflateEnd(&strm);
+                free(out);
+                return nullptr;
+            }
+            have = out_buf_len - strm.avail_out;
+            *out_len += have;
+        } while (strm.avail_out == 0);
+    } while (ret != Z_STREAM_END);
+    (void)inflateEnd(&strm);
+    return out;
+}
+
+// opus frames barely compress
+static std::vector<uint8_t> opusPayload(size_t len) {
+    std::vector<uint8_t> payload(len);
+    uint32_t seed = 7;
+    for (auto& b : payload) {
+        seed = seed * 1103515245 + 12345;
+        b = seed >> 16;
+    }
+    return payload;
+}
+
+// mcp messages are json tool lists and calls
+static std::vector<uint8_t> mcpPayload(size_t len) {
+    std::string json = "{\"jsonrpc\":\"2.0\",\"id\":1,\"result\":{\"tools\":[";
+    for (int i = 0; json.size() < len; i++) {
+        json += "{\"name\":\"tool_" + std::to_string(i) + "\",\"description\":\"moves object " +
+            std::to_string(i * 37 % 1000) + " on the screen\",\"inputSchema\":{\"type\":\"object\"," +
+            "\"properties\":{\"x\":{\"type\":\"integer\"},\"y\":{\"type\":\"integer\"}}}},";
+    }
+    json.resize(len);
+    return std::vector<uint8_t>(json.begin(), json.end());
+}
+
+static void run(const char* name, const std::vector<uint8_t>& payload) {
+    ZlibCodec codec;
+    std::vector<uint8_t> compressed(codec.compressBound(payload.size()));
+    size_t compressedLen = 0;
+    CHECK(codec.compress(payload.data(), payload.size(), compressed.data(), compressed.size(), &compressedLen));
+    size_t len = 0;
+    const uint8_t* out = codec.decompress(compressed.data(), compressedLen, &len);
+    CHECK(out && len == payload.size() && memcmp(out, payload.data(), len) == 0);
+
+    std::string deflateName = std::string(name) + " deflate";
+    double newNs = benchNs([&]() {
+        codec.compress(payload.data(), payload.size(), compressed.data(), compressed.size(), &compressedLen);
+    });
+    double legacyNs = benchNs([&]() {
+        size_t outLen = 0;
+        free(legacyDefl(payload.data(), payload.size(), &outLen, Z_BEST_SPEED));
+    });
+    benchReport(deflateName.c_str(), legacyNs, newNs);
+
+    std::string inflateName = std::string(name) + " inflate";
+    newNs = benchNs([&]() {
+        benchKeep(codec.decompress(compressed.data(), compressedLen, &len));
+    });
+    // the legacy output buffer is capped at 3x the input, bigger payloads were overwritten
+    // in place, it still does the same inflate work
+    legacyNs = benchNs([&]() {
+        size_t outLen = 0;
+        free(legacyInfl(compressed.data(), compressedLen, &outLen));
+    });
+    benchReport(inflateName.c_str(), legacyNs, newNs);
+}
+
+// one message per call, legacy helpers against the persistent per connection codec
+int main() {
+    run("opus 120B", opusPayload(120));
+    run("opus 3x120B batch", opusPayload(360));
+    run("mcp 1KB", mcpPayload(1024));
+    run("mcp 8KB", mcpPayload(8 * 1024));
+    run("mcp 24KB", mcpPayload(24 * 1024));
+    return 0;
+}
@@ -0,0 +1,41 @@
+#include "fake_esp_sr.h"
+#include <esp_afe_sr_models.h>
+#include <model_path.h>
+
+FakeAfeFeeds& fakeAfeFeeds() {
+    static FakeAfeFeeds feeds;
+    return feeds;
+}
+
+static int getFeedChunksize(esp_afe_sr_data_t*) { return FAKE_AFE_FEED_CHUNK; }
+static int getFetchChunksize(esp_afe_sr_data_t*) { return FAKE_AFE_FEED_CHUNK; }
+static int feed(esp_afe_sr_data_t*, const int16_t* in) {
+    auto& feeds = fakeAfeFeeds();
+    size_t samples = FAKE_AFE_FEED_CHUNK * feeds.channels;
+    if (feeds.record) {
+        feeds.samples.insert(feeds.samples.end(), in, in + samples);
+    }
+    // what the real afe does first, copy the chunk out
+    feeds.checksum += in[0] + in[samples - 1];
+    if (in >= feeds.blockBegin && in < feeds.blockEnd) {
+        feeds.inPlace++;
+    }
+    feeds.count++;
+    return FAKE_AFE_FEED_CHUNK;
+}
+static afe_fetch_result_t* fetchWithDelay(esp_afe_sr_data_t*, TickType_t) { return nullptr; }
+static int noop(esp_afe_sr_data_t*) { return 0; }
+static esp_afe_sr_data_t* createFromConfig(afe_config_t*) { return (esp_afe_sr_data_t*)&fakeAfeFeeds(); }
+static void destroy(esp_afe_sr_data_t*) {}
+
+static esp_afe_sr_iface_t s_iface = {createFromConfig, getFeedChunksize, getFetchChunksize, feed,
+    fetchWithDelay, noop, noop, noop, destroy};
+static afe_config_t s_config;
+static char s_modelName[] = "wn9_test";
+static char* s_modelNames[] = {s_modelName};
+static srmodel_list_t s_models = {1, s_modelNames};
+
+afe_config_t* afe_config_init(const char*, srmodel_list_t*, afe_type_t, afe_mode_t) { return &s_config; }
+esp_afe_sr_iface_t* esp_afe_handle_from_config(afe_config_t*) { return &s_iface; }
+srmodel_list_t* esp_srmodel_init(const char*) { return &s_models; }
+char* esp_srmodel_filter(srmodel_list_t*, const char*, const char*) { return nullptr; }
@@ -0,0 +1,26 @@
+#ifndef _FAKE_ESP_SR_H_
+#define _FAKE_ESP_SR_H_
+#include <stdint.h>
+#include <vector>
+
+// esp-sr stand in for AudioFrontEnd: one model, a fixed feed chunk, fetch never has a result.
+// feeds are counted and, when record is set, their samples kept
+#define FAKE_AFE_FEED_CHUNK 512
+
+struct FakeAfeFeeds {
+    // set before feeding, samples per feed chunk are FAKE_AFE_FEED_CHUNK * channels
+    int                     channels = 1;
+    bool                    record = false;
+    std::vector<int16_t>    samples;
+    // feeds that pointed into [blockBegin, blockEnd), the caller's mic block
+    const int16_t*          blockBegin = nullptr;
+    const int16_t*          blockEnd = nullptr;
+    int                     inPlace = 0;
+    int                     count = 0;
+    // keeps the fed data alive for benchmarks that don't record
+    int64_t                 checksum = 0;
+};
+
+FakeAfeFeeds& fakeAfeFeeds();
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _HOST_MEMORY_ALLOCATOR_H_
+#define _HOST_MEMORY_ALLOCATOR_H_
+#include <stdlib.h>
+
+inline void* psram_prefered_malloc(size_t size) { return malloc(size); }
+inline void* psram_prefered_realloc(void* ptr, size_t size) { return realloc(ptr, size); }
+
+#endif
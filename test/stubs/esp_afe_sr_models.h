@@ -0,0 +1,64 @@
+#ifndef _HOST_ESP_AFE_SR_MODELS_H_
+#define _HOST_ESP_AFE_SR_MODELS_H_
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+// the parts of esp-sr the front end uses, tests provide the interface
+typedef struct {
+    int num;
+    char** model_name;
+} srmodel_list_t;
+
+typedef struct esp_afe_sr_data_t esp_afe_sr_data_t;
+
+typedef enum { AFE_TYPE_SR } afe_type_t;
+typedef enum { AFE_MODE_HIGH_PERF } afe_mode_t;
+typedef enum { AEC_MODE_SR_LOW_COST } afe_aec_mode_t;
+typedef enum { AFE_NS_MODE_NET } afe_ns_mode_t;
+typedef enum { VAD_MODE_0 } vad_mode_t;
+typedef enum { DET_MODE_95 } det_mode_t;
+typedef enum { AFE_MEMORY_ALLOC_MORE_PSRAM } afe_memory_alloc_mode_t;
+typedef enum { WAKENET_NO_DETECT, WAKENET_DETECTED } wakenet_state_t;
+
+typedef struct {
+    bool aec_init;
+    afe_aec_mode_t aec_mode;
+    bool ns_init;
+    char* ns_model_name;
+    afe_ns_mode_t afe_ns_mode;
+    bool vad_init;
+    vad_mode_t vad_mode;
+    int vad_min_noise_ms;
+    bool agc_init;
+    det_mode_t wakenet_mode;
+    int afe_perferred_core;
+    int afe_perferred_priority;
+    afe_memory_alloc_mode_t memory_alloc_mode;
+} afe_config_t;
+
+typedef struct {
+    int16_t* data;
+    int data_size;
+    int vad_state;
+    wakenet_state_t wakeup_state;
+    int wake_word_index;
+    int ret_value;
+} afe_fetch_result_t;
+
+typedef struct {
+    esp_afe_sr_data_t* (*create_from_config)(afe_config_t* config);
+    int (*get_feed_chunksize)(esp_afe_sr_data_t* afe);
+    int (*get_fetch_chunksize)(esp_afe_sr_data_t* afe);
+    int (*feed)(esp_afe_sr_data_t* afe, const int16_t* in);
+    afe_fetch_result_t* (*fetch_with_delay)(esp_afe_sr_data_t* afe, TickType_t ticks);
+    int (*reset_buffer)(esp_afe_sr_data_t* afe);
+    int (*enable_wakenet)(esp_afe_sr_data_t* afe);
+    int (*disable_wakenet)(esp_afe_sr_data_t* afe);
+    void (*destroy)(esp_afe_sr_data_t* afe);
+} esp_afe_sr_iface_t;
+
+afe_config_t* afe_config_init(const char* input_format, srmodel_list_t* models, afe_type_t type, afe_mode_t mode);
+esp_afe_sr_iface_t* esp_afe_handle_from_config(afe_config_t* config);
+
+#endif
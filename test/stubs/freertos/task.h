@@ -0,0 +1,16 @@
+#ifndef _HOST_FREERTOS_TASK_H_
+#define _HOST_FREERTOS_TASK_H_
+#include "FreeRTOS.h"
+
+typedef void (*TaskFunction_t)(void*);
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite } eNotifyAction;
+
+// tasks are std::threads, a null handle deletes the calling task
+BaseType_t xTaskCreateWithCaps(TaskFunction_t task, const char* name, uint32_t stackDepth, void* arg,
+    UBaseType_t priority, TaskHandle_t* handle, uint32_t caps);
+void vTaskDelete(TaskHandle_t handle);
+void vTaskDelay(TickType_t ticks);
+BaseType_t xTaskNotify(TaskHandle_t handle, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t ticks);
+
+#endif
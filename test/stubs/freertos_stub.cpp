@@ -0,0 +1,191 @@
+// FreeRTOS and esp_timer on top of std::thread, just enough for the sources under test
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct HostTask {
+    std::mutex              mutex;
+    std::condition_variable cond;
+    uint32_t                value = 0;
+    bool                    pending = false;
+};
+
+struct HostEventGroup {
+    std::mutex              mutex;
+    std::condition_variable cond;
+    EventBits_t             bits = 0;
+};
+
+thread_local HostTask* t_currentTask = nullptr;
+std::mutex s_timerMutex;
+std::vector<esp_timer_handle_t> s_startedTimers;
+
+template <typename Pred>
+bool waitFor(std::condition_variable& cond, std::unique_lock<std::mutex>& lock, TickType_t ticks, Pred pred) {
+    if (ticks == portMAX_DELAY) {
+        cond.wait(lock, pred);
+        return true;
+    }
+    return cond.wait_for(lock, std::chrono::milliseconds(ticks * portTICK_PERIOD_MS), pred);
+}
+
+}
+
+struct esp_timer {
+    esp_timer_create_args_t args;
+};
+
+// name, stack, priority and caps mean nothing to a std::thread
+BaseType_t xTaskCreateWithCaps(TaskFunction_t task, const char*, uint32_t, void* arg, UBaseType_t,
+    TaskHandle_t* handle, uint32_t) {
+    // tasks never exit on the device, the handle lives as long as the process
+    auto hostTask = new HostTask();
+    if (handle) {
+        *handle = hostTask;
+    }
+    std::thread([task, arg, hostTask]() {
+        t_currentTask = hostTask;
+        task(arg);
+    }).detach();
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t) {
+}
+
+void vTaskDelay(TickType_t ticks) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks * portTICK_PERIOD_MS));
+}
+
+BaseType_t xTaskNotify(TaskHandle_t handle, uint32_t value, eNotifyAction action) {
+    auto task = (HostTask*)handle;
+    {
+        std::lock_guard<std::mutex> lock(task->mutex);
+        if (action == eSetBits) {
+            task->value |= value;
+        } else if (action == eIncrement) {
+            task->value++;
+        } else if (action == eSetValueWithOverwrite) {
+            task->value = value;
+        }
+        task->pending = true;
+    }
+    task->cond.notify_all();
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value, TickType_t ticks) {
+    auto task = t_currentTask;
+    std::unique_lock<std::mutex> lock(task->mutex);
+    task->value &= ~clearOnEntry;
+    if (!waitFor(task->cond, lock, ticks, [task]() { return task->pending; })) {
+        return pdFALSE;
+    }
+    task->pending = false;
+    if (value) {
+        *value = task->value;
+    }
+    task->value &= ~clearOnExit;
+    return pdTRUE;
+}
+
+EventGroupHandle_t xEventGroupCreate() {
+    return new HostEventGroup();
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) {
+    delete (HostEventGroup*)group;
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+    auto eventGroup = (HostEventGroup*)group;
+    std::lock_guard<std::mutex> lock(eventGroup->mutex);
+    eventGroup->bits |= bits;
+    eventGroup->cond.notify_all();
+    return eventGroup->bits;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+    auto eventGroup = (HostEventGroup*)group;
+    std::lock_guard<std::mutex> lock(eventGroup->mutex);
+    EventBits_t old = eventGroup->bits;
+    eventGroup->bits &= ~bits;
+    return old;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+    auto eventGroup = (HostEventGroup*)group;
+    std::lock_guard<std::mutex> lock(eventGroup->mutex);
+    return eventGroup->bits;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clearOnExit,
+    BaseType_t waitForAll, TickType_t ticks) {
+    auto eventGroup = (HostEventGroup*)group;
+    std::unique_lock<std::mutex> lock(eventGroup->mutex);
+    waitFor(eventGroup->cond, lock, ticks, [&]() {
+        EventBits_t set = eventGroup->bits & bits;
+        return waitForAll ? set == bits : set != 0;
+    });
+    EventBits_t result = eventGroup->bits;
+    EventBits_t set = result & bits;
+    if (clearOnExit && (waitForAll ? set == bits : set != 0)) {
+        eventGroup->bits &= ~bits;
+    }
+    return result;
+}
+
+int64_t esp_timer_get_time() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+    *handle = new esp_timer{*args};
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t) {
+    std::lock_guard<std::mutex> lock(s_timerMutex);
+    s_startedTimers.push_back(timer);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    std::lock_guard<std::mutex> lock(s_timerMutex);
+    for (auto it = s_startedTimers.begin(); it != s_startedTimers.end(); it++) {
+        if (*it == timer) {
+            s_startedTimers.erase(it);
+            break;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    delete timer;
+    return ESP_OK;
+}
+
+void esp_timer_fire_started() {
+    std::vector<esp_timer_handle_t> timers;
+    {
+        std::lock_guard<std::mutex> lock(s_timerMutex);
+        timers = s_startedTimers;
+    }
+    for (auto timer : timers) {
+        timer->args.callback(timer->args.arg);
+    }
+}
+
+size_t heap_caps_get_free_size(uint32_t) {
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef _HOST_MODEL_PATH_H_
+#define _HOST_MODEL_PATH_H_
+#include "esp_afe_sr_models.h"
+
+#define ESP_WN_PREFIX "wn"
+#define ESP_NSNET_PREFIX "nsnet"
+
+srmodel_list_t* esp_srmodel_init(const char* partition_label);
+char* esp_srmodel_filter(srmodel_list_t* models, const char* keyword1, const char* keyword2);
+
+#endif
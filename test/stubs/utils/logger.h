@@ -0,0 +1,9 @@
+#ifndef _HOST_LOGGER_H_
+#define _HOST_LOGGER_H_
+#include <stdio.h>
+
+#define LOGE(...) printf(__VA_ARGS__)
+#define LOGW(...) printf(__VA_ARGS__)
+#define LOGI(...) printf(__VA_ARGS__)
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _HOST_TEST_H_
+#define _HOST_TEST_H_
+#include <stdio.h>
+#include <stdlib.h>
+
+// unlike assert this stays on in release builds
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#endif
@@ -0,0 +1,38 @@
+#include "audio_processing/audio_front_end.h"
+#include "fake_esp_sr.h"
+#include "test.h"
+#include <string.h>
+#include <vector>
+
+#define CHANNELS 2
+
+// mic blocks of any size come out as the same samples in whole chunks
+int main() {
+    auto& feeds = fakeAfeFeeds();
+    feeds.channels = CHANNELS;
+    feeds.record = true;
+    // its fetch task never exits, so the front end is never destroyed
+    auto frontEnd = new AudioFrontEnd();
+    frontEnd->Initialize(CHANNELS, true);
+    std::vector<int16_t> input;
+    size_t chunk = FAKE_AFE_FEED_CHUNK * CHANNELS;
+    size_t blockSizes[] = {320, 1, 1500, chunk, 3 * chunk + 7, 2999};
+    for (int round = 0; round < 20; round++) {
+        for (size_t size : blockSizes) {
+            std::vector<int16_t> block(size);
+            for (auto& sample : block) {
+                sample = (int16_t)input.size();
+                input.push_back(sample);
+            }
+            feeds.blockBegin = block.data();
+            feeds.blockEnd = block.data() + block.size();
+            frontEnd->Feed(block.data(), block.size());
+        }
+    }
+    CHECK(feeds.samples.size() == input.size() / chunk * chunk);
+    CHECK(memcmp(feeds.samples.data(), input.data(), feeds.samples.size() * sizeof(int16_t)) == 0);
+    // whole chunks inside a block skip the staging copy
+    CHECK(feeds.inPlace > 0);
+    printf("audio front end ok, %d feeds, %d from the mic block\n", feeds.count, feeds.inPlace);
+    return 0;
+}
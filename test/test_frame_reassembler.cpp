@@ -0,0 +1,80 @@
+#include "socket/frame_reassembler.h"
+#include "test.h"
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+static void appendFrame(std::vector<uint8_t>& stream, const std::vector<uint8_t>& frame) {
+    uint32_t len = frame.size();
+    stream.push_back(len >> 24);
+    stream.push_back(len >> 16);
+    stream.push_back(len >> 8);
+    stream.push_back(len);
+    stream.insert(stream.end(), frame.begin(), frame.end());
+}
+
+// frames of any size, split at random points, come out whole and in order
+static void testRandomSplit() {
+    std::mt19937 rng(1);
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<uint8_t> stream;
+    for (int i = 0; i < 2000; i++) {
+        std::vector<uint8_t> frame(rng() % (i % 50 == 0 ? 100000 : 300));
+        for (auto& b : frame) {
+            b = rng();
+        }
+        appendFrame(stream, frame);
+        frames.push_back(std::move(frame));
+    }
+    FrameReassembler reassembler;
+    size_t received = 0;
+    size_t pos = 0;
+    while (pos < stream.size()) {
+        size_t len = std::min<size_t>(1 + rng() % 5000, stream.size() - pos);
+        bool ok = reassembler.feed(stream.data() + pos, len, [&](const uint8_t* frame, size_t frameLen) {
+            CHECK(received < frames.size());
+            CHECK(frameLen == frames[received].size());
+            CHECK(frameLen == 0 || memcmp(frame, frames[received].data(), frameLen) == 0);
+            received++;
+        });
+        CHECK(ok);
+        pos += len;
+    }
+    CHECK(received == frames.size());
+    CHECK(reassembler.getPendingLen() == 0);
+    // only one partial frame is staged, the buffer grows in doublings up to the largest frame
+    CHECK(reassembler.getCapacity() < 2 * (100000 + FRAME_LEN_PREFIX_SIZE));
+}
+
+// complete frames inside one chunk are handed out in place, nothing is staged
+static void testWholeFramesInPlace() {
+    std::vector<uint8_t> stream;
+    appendFrame(stream, {1, 2, 3});
+    appendFrame(stream, {4, 5});
+    FrameReassembler reassembler;
+    int frames = 0;
+    CHECK(reassembler.feed(stream.data(), stream.size(), [&](const uint8_t* frame, size_t len) {
+        CHECK(frame >= stream.data() && frame + len <= stream.data() + stream.size());
+        frames++;
+    }));
+    CHECK(frames == 2);
+    CHECK(reassembler.getPendingLen() == 0);
+}
+
+static void testFrameTooLarge() {
+    FrameReassembler reassembler(1024, 1024);
+    std::vector<uint8_t> stream;
+    appendFrame(stream, std::vector<uint8_t>(2048));
+    CHECK(!reassembler.feed(stream.data(), stream.size(), [](const uint8_t*, size_t) {
+        CHECK(false);
+    }));
+}
+
+int main() {
+    testRandomSplit();
+    testWholeFramesInPlace();
+    testFrameTooLarge();
+    printf("frame reassembler ok\n");
+    return 0;
+}
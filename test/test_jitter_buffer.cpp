@@ -0,0 +1,119 @@
+#include "big_mouth_ai/jitter_buffer.h"
+#include "test.h"
+#include <random>
+#include <vector>
+
+#define FRAME_US 60000
+
+static const uint8_t PACKET[10] = {0};
+
+static void pushFrames(JitterBuffer& buffer, int count, int64_t& nowUs) {
+    for (int i = 0; i < count; i++) {
+        CHECK(buffer.push(PACKET, sizeof(PACKET), nowUs));
+        nowUs += FRAME_US;
+    }
+}
+
+// playback waits for target depth, a late packet is concealed, a longer gap rebuffers deeper
+static void testUnderrun() {
+    JitterBuffer buffer;
+    std::vector<uint8_t> out;
+    int64_t nowUs = 0;
+    buffer.start();
+    uint16_t target = buffer.getStats().targetDepth;
+    pushFrames(buffer, target - 1, nowUs);
+    CHECK(buffer.pop(out) == JITTER_WAIT);
+    pushFrames(buffer, 1, nowUs);
+    for (int i = 0; i < target; i++) {
+        CHECK(buffer.pop(out) == JITTER_FRAME);
+        CHECK(out.size() == sizeof(PACKET));
+    }
+    for (int i = 0; i < JitterBufferConfig().maxConcealFrames; i++) {
+        CHECK(buffer.pop(out) == JITTER_CONCEAL);
+    }
+    CHECK(buffer.pop(out) == JITTER_WAIT);
+    auto stats = buffer.getStats();
+    CHECK(stats.underruns == 1);
+    CHECK(stats.concealed == JitterBufferConfig().maxConcealFrames);
+    CHECK(stats.targetDepth == target + 1);
+}
+
+// running dry after a sentence is a pause: no PLC, no underrun, and its tail isn't held back
+static void testSentencePause() {
+    JitterBuffer buffer;
+    std::vector<uint8_t> out;
+    int64_t nowUs = 0;
+    buffer.start();
+    uint16_t target = buffer.getStats().targetDepth;
+    pushFrames(buffer, 1, nowUs);
+    buffer.endOfSentence();
+    CHECK(buffer.pop(out) == JITTER_FRAME);
+    CHECK(buffer.pop(out) == JITTER_WAIT);
+    CHECK(buffer.pop(out) == JITTER_WAIT);
+    // the next sentence buffers up to target depth again
+    pushFrames(buffer, 1, nowUs);
+    CHECK(buffer.pop(out) == JITTER_WAIT);
+    auto stats = buffer.getStats();
+    CHECK(stats.concealed == 0);
+    CHECK(stats.underruns == 0);
+    CHECK(stats.targetDepth == target);
+}
+
+// the tail of a stream plays right away, a clean stream lowers the target depth
+static void testEndOfStream() {
+    JitterBuffer buffer;
+    std::vector<uint8_t> out;
+    int64_t nowUs = 0;
+    buffer.start();
+    uint16_t target = buffer.getStats().targetDepth;
+    pushFrames(buffer, 1, nowUs);
+    buffer.endOfStream();
+    CHECK(buffer.pop(out) == JITTER_FRAME);
+    CHECK(buffer.drained());
+    CHECK(buffer.pop(out) == JITTER_WAIT);
+    auto stats = buffer.getStats();
+    CHECK(stats.concealed == 0);
+    CHECK(stats.underruns == 0);
+    CHECK(stats.targetDepth == target - 1);
+}
+
+// realtime sender with 5% of packets 250ms late, every packet is played exactly once
+static void testLateArrivalTrace() {
+    JitterBuffer buffer;
+    std::mt19937 rng(1);
+    std::vector<uint8_t> out;
+    const int frames = 900;
+    int sent = 0;
+    int64_t nextSend = 0;
+    buffer.start();
+    for (int64_t nowUs = 0; nowUs < 60000000; nowUs += 10000) {
+        while (nextSend <= nowUs && sent < frames) {
+            CHECK(buffer.push(PACKET, sizeof(PACKET), nowUs));
+            sent++;
+            nextSend = sent * FRAME_US + (rng() % 100 < 5 ? 250000 : 0);
+        }
+        if (nowUs % FRAME_US == 0) {
+            buffer.pop(out);
+        }
+    }
+    buffer.endOfStream();
+    while (buffer.pop(out) != JITTER_WAIT) {
+    }
+    auto stats = buffer.getStats();
+    CHECK(buffer.drained());
+    CHECK(stats.pushed == frames);
+    CHECK(stats.played == frames);
+    CHECK(stats.concealed > 0);
+    CHECK(stats.targetDepth <= JitterBufferConfig().maxDepth);
+    printf("trace: concealed %u underruns %u target %u jitter %uus\n", stats.concealed, stats.underruns,
+        stats.targetDepth, stats.jitter);
+}
+
+int main() {
+    testUnderrun();
+    testSentencePause();
+    testEndOfStream();
+    testLateArrivalTrace();
+    printf("jitter buffer ok\n");
+    return 0;
+}
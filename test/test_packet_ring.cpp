@@ -0,0 +1,94 @@
+#include "big_mouth_ai/packet_ring.h"
+#include "big_mouth_ai/jitter_buffer.h"
+#include "test.h"
+#include <string.h>
+#include <thread>
+#include <vector>
+
+// one producer and one consumer thread, every packet arrives once, in order, with its tag
+static void testProducerConsumer() {
+    const uint32_t count = 20000;
+    PacketRing ring(8, 64);
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < count;) {
+            uint8_t packet[8];
+            memcpy(packet, &i, 4);
+            memcpy(packet + 4, &i, 4);
+            if (ring.push(packet, 4 + i % 5, i)) {
+                i++;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (uint32_t expected = 0; expected < count;) {
+        size_t len = 0;
+        uint32_t tag = 0;
+        const uint8_t* packet = ring.front(&len, &tag);
+        if (!packet) {
+            std::this_thread::yield();
+            continue;
+        }
+        uint32_t value;
+        memcpy(&value, packet, 4);
+        CHECK(value == expected);
+        CHECK(tag == expected);
+        CHECK(len == 4 + expected % 5);
+        ring.pop();
+        expected++;
+    }
+    producer.join();
+    CHECK(ring.size() == 0);
+}
+
+static void testDiscardAll() {
+    PacketRing ring(4, 16);
+    size_t len = 0;
+    CHECK(ring.push((const uint8_t*)"abcd", 4));
+    CHECK(ring.push((const uint8_t*)"efgh", 4));
+    ring.discardAll();
+    CHECK(ring.size() == 0);
+    CHECK(!ring.front(&len));
+    CHECK(ring.push((const uint8_t*)"xyzw", 4));
+    CHECK(ring.size() == 1);
+    CHECK(ring.front(&len)[0] == 'x');
+    // slot sized packets only
+    CHECK(!ring.push(nullptr, 17));
+}
+
+// a full jitter buffer refuses the packet instead of dropping it, the caller decides
+static void testJitterBufferFull() {
+    JitterBufferConfig config;
+    config.capacity = 4;
+    config.slotSize = 16;
+    JitterBuffer buffer(config);
+    const uint8_t packet[16] = {0};
+    std::vector<uint8_t> out;
+    buffer.start();
+    for (int i = 0; i < config.capacity; i++) {
+        CHECK(buffer.push(packet, sizeof(packet), i * 60000));
+    }
+    CHECK(buffer.full());
+    CHECK(!buffer.push(packet, sizeof(packet), 240000));
+    CHECK(buffer.getStats().overruns == 0);
+    // playback makes room again
+    CHECK(buffer.pop(out) == JITTER_FRAME);
+    CHECK(!buffer.full());
+    CHECK(buffer.push(packet, sizeof(packet), 240000));
+    buffer.dropFrame();
+    CHECK(buffer.getStats().overruns == 1);
+    // a packet that can never fit is dropped and counted right away
+    uint8_t large[32] = {0};
+    CHECK(buffer.push(large, sizeof(large), 300000));
+    auto stats = buffer.getStats();
+    CHECK(stats.overruns == 2);
+    CHECK(stats.pushed == config.capacity + 1u);
+}
+
+int main() {
+    testProducerConsumer();
+    testDiscardAll();
+    testJitterBufferFull();
+    printf("packet ring ok\n");
+    return 0;
+}
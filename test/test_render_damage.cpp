@@ -0,0 +1,94 @@
+#include "render_damage.h"
+#include "test.h"
+#include <vector>
+
+static bool covered(const std::vector<DamageRect>& rects, int x, int y) {
+    for (auto& rect : rects) {
+        if (x >= rect.x1 && x <= rect.x2 && y >= rect.y1 && y <= rect.y2) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t totalPixels(const std::vector<DamageRect>& rects) {
+    uint32_t pixels = 0;
+    for (auto& rect : rects) {
+        pixels += rect.pixels();
+    }
+    return pixels;
+}
+
+// every changed pixel is inside a rect, the rects stay in the frame and don't overlap
+static void checkDamage(RenderDamage& damage, const std::vector<uint16_t>& prev, const std::vector<uint16_t>& frame,
+    int width, int height) {
+    auto& rects = damage.update(frame.data());
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            if (prev[y * width + x] != frame[y * width + x]) {
+                CHECK(covered(rects, x, y));
+            }
+        }
+    }
+    for (size_t i = 0; i < rects.size(); i++) {
+        auto& rect = rects[i];
+        CHECK(rect.x1 >= 0 && rect.y1 >= 0 && rect.x1 <= rect.x2 && rect.y1 <= rect.y2);
+        CHECK(rect.x2 < width && rect.y2 < height);
+        for (size_t j = i + 1; j < rects.size(); j++) {
+            auto& other = rects[j];
+            CHECK(rect.x2 < other.x1 || other.x2 < rect.x1 || rect.y2 < other.y1 || other.y2 < rect.y1);
+        }
+    }
+    CHECK(damage.getDamagedPixels() == totalPixels(rects));
+}
+
+int main() {
+    // not a multiple of the tile size, edge tiles are clipped
+    const int width = 240;
+    const int height = 250;
+    std::vector<uint16_t> frame(width * height, 0);
+    RenderDamage damage(width, height);
+
+    // nothing to compare against, the whole frame is damaged
+    auto& first = damage.update(frame.data());
+    CHECK(first.size() == 1);
+    CHECK(damage.getDamagedPixels() == width * height);
+
+    CHECK(damage.update(frame.data()).empty());
+    CHECK(damage.getDamagedPixels() == 0);
+
+    auto prev = frame;
+    for (int y = 100; y < 140; y++) {
+        for (int x = 50; x < 90; x++) {
+            frame[y * width + x] = y + x;
+        }
+    }
+    checkDamage(damage, prev, frame, width, height);
+    // a 40x40 box touches at most 4x4 tiles of 16
+    CHECK(damage.getDamagedPixels() <= 64 * 64);
+
+    prev = frame;
+    frame[5 * width + 235] = 1;
+    frame[249 * width] = 3;
+    checkDamage(damage, prev, frame, width, height);
+    CHECK(damage.update(frame.data()).empty());
+
+    // far apart corners stay separate rects instead of one that spans the frame
+    prev = frame;
+    frame[0] = 7;
+    frame[249 * width + 239] = 7;
+    checkDamage(damage, prev, frame, width, height);
+    CHECK(damage.getDamagedPixels() < width * height / 4);
+
+    prev = frame;
+    for (size_t i = 0; i < frame.size(); i += 37) {
+        frame[i] ^= 0xffff;
+    }
+    checkDamage(damage, prev, frame, width, height);
+
+    damage.invalidateAll();
+    damage.update(frame.data());
+    CHECK(damage.getDamagedPixels() == width * height);
+    printf("render damage ok\n");
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "task_executor.h"
+#include "test.h"
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void testInlineAndHeap() {
+    int value = 0;
+    TaskFunction small([&value]() { value++; });
+    CHECK(small.isInline());
+    char big[TaskFunction::INLINE_SIZE + 1] = {0};
+    TaskFunction large([&value, big]() { value += big[0] + 1; });
+    CHECK(!large.isInline());
+    TaskFunction moved(std::move(large));
+    CHECK(!large);
+    small();
+    moved();
+    CHECK(value == 2);
+}
+
+static void testPriority() {
+    TaskExecutor executor("priority");
+    std::string order;
+    executor.post([&order]() { order += 'l'; }, TASK_PRIORITY_LOW);
+    executor.post([&order]() { order += 'n'; });
+    executor.post([&order]() { order += 'h'; }, TASK_PRIORITY_HIGH);
+    CHECK(!executor.drain());
+    CHECK(order == "hnl");
+    CHECK(executor.empty());
+}
+
+// posts beyond the capacity spill and still run in order
+static void testSpill() {
+    TaskExecutor executor("spill", 8);
+    std::vector<int> order;
+    for (int i = 0; i < 20; i++) {
+        executor.post([&order, i]() { order.push_back(i); });
+    }
+    CHECK(!executor.empty());
+    auto stats = executor.getStats();
+    CHECK(stats.spilled == 12);
+    CHECK(stats.depth == 20);
+    CHECK(!executor.drain());
+    CHECK(order.size() == 20);
+    for (int i = 0; i < 20; i++) {
+        CHECK(order[i] == i);
+    }
+    CHECK(executor.empty());
+    CHECK(executor.getStats().executed == 20);
+}
+
+// budget is spent after the first task, the rest is left for the next drain
+static void testBudget() {
+    TaskExecutor executor("budget");
+    int ran = 0;
+    for (int i = 0; i < 3; i++) {
+        executor.post([&ran]() {
+            ran++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        });
+    }
+    CHECK(executor.drain(1000));
+    CHECK(ran == 1);
+    CHECK(!executor.drain());
+    CHECK(ran == 3);
+    CHECK(executor.getStats().overBudget == 1);
+}
+
+// several producers against one consumer, nothing is lost and each producer stays in order
+static void testProducers() {
+    const int producers = 4;
+    const int posts = 100000;
+    TaskExecutor executor("producers", 16);
+    std::vector<std::vector<int>> seen(producers);
+    std::atomic<bool> stop{false};
+    std::thread consumer([&]() {
+        while (!stop || !executor.empty()) {
+            executor.drain(100);
+        }
+    });
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.emplace_back([&executor, &seen, p]() {
+            for (int i = 0; i < posts; i++) {
+                executor.post([&seen, p, i]() { seen[p].push_back(i); });
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    stop = true;
+    consumer.join();
+    for (auto& values : seen) {
+        CHECK(values.size() == posts);
+        for (int i = 0; i < posts; i++) {
+            CHECK(values[i] == i);
+        }
+    }
+    auto stats = executor.getStats();
+    CHECK(stats.posted == producers * posts);
+    CHECK(stats.executed == producers * posts);
+}
+
+int main() {
+    testInlineAndHeap();
+    testPriority();
+    testSpill();
+    testBudget();
+    testProducers();
+    printf("task executor ok\n");
+    return 0;
+}
@@ -0,0 +1,80 @@
+#include "timer_wheel.h"
+#include "test.h"
+#include <thread>
+#include <vector>
+
+static std::mutex s_mutex;
+static std::vector<std::pair<int, int>> s_fired;
+static int s_tick = 0;
+
+static TaskFunction record(int timer) {
+    return [timer]() {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_fired.push_back({timer, s_tick});
+    };
+}
+
+// one wheel step, returns once the worker ran everything it expired
+static void step(TimerWheel& wheel) {
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_tick++;
+    }
+    esp_timer_fire_started();
+    while (true) {
+        auto stats = wheel.getExecutor().getStats();
+        if (stats.executed == stats.posted) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+}
+
+static std::vector<int> firedAt(int timer) {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    std::vector<int> ticks;
+    for (auto& fired : s_fired) {
+        if (fired.first == timer) {
+            ticks.push_back(fired.second);
+        }
+    }
+    return ticks;
+}
+
+int main() {
+    // 100ms ticks, 8 slots, 4 timers
+    TimerWheel wheel(100, 8, 4);
+    wheel.start();
+    CHECK(wheel.schedule(250, record(1)));
+    // more ticks than slots, goes around the wheel once
+    CHECK(wheel.schedule(1000, record(2)));
+    TimerId cancelled = wheel.schedule(500, record(3));
+    CHECK(cancelled);
+    TimerId periodic = wheel.schedule(300, record(4), 300);
+    CHECK(periodic);
+    // the pool is fixed
+    CHECK(!wheel.schedule(100, record(5)));
+    CHECK(wheel.cancel(cancelled));
+    CHECK(!wheel.cancel(cancelled));
+    // a freed node is reused, the stale id stays dead
+    TimerId reused = wheel.schedule(100, record(6));
+    CHECK(reused && reused != cancelled);
+    CHECK(!wheel.cancel(cancelled));
+    for (int i = 0; i < 12; i++) {
+        step(wheel);
+    }
+    CHECK(firedAt(1) == std::vector<int>({3}));
+    CHECK(firedAt(2) == std::vector<int>({10}));
+    CHECK(firedAt(3).empty());
+    CHECK((firedAt(4) == std::vector<int>({3, 6, 9, 12})));
+    CHECK(firedAt(6) == std::vector<int>({1}));
+    // a fired one shot can't be cancelled, a periodic one can
+    CHECK(!wheel.cancel(reused));
+    CHECK(wheel.cancel(periodic));
+    for (int i = 0; i < 4; i++) {
+        step(wheel);
+    }
+    CHECK(firedAt(4).size() == 4);
+    printf("timer wheel ok\n");
+    return 0;
+}
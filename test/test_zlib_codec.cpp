@@ -0,0 +1,44 @@
+#include "socket/zlib_codec.h"
+#include "test.h"
+#include <string.h>
+#include <vector>
+
+static void roundTrip(ZlibCodec& codec, const std::vector<uint8_t>& data) {
+    std::vector<uint8_t> compressed(codec.compressBound(data.size()));
+    size_t compressedLen = 0;
+    CHECK(codec.compress(data.data(), data.size(), compressed.data(), compressed.size(), &compressedLen));
+    CHECK(compressedLen <= compressed.size());
+    size_t len = 0;
+    const uint8_t* out = codec.decompress(compressed.data(), compressedLen, &len);
+    CHECK(out);
+    CHECK(len == data.size());
+    CHECK(len == 0 || memcmp(out, data.data(), len) == 0);
+}
+
+int main() {
+    ZlibCodec codec;
+    // the streams are reset between messages, one codec serves them all
+    for (size_t size : {0, 10, 1000, 200000}) {
+        std::vector<uint8_t> data(size);
+        for (size_t i = 0; i < size; i++) {
+            data[i] = i % 7;
+        }
+        roundTrip(codec, data);
+    }
+    // incompressible data still fits compressBound
+    std::vector<uint8_t> noise(50000);
+    uint32_t seed = 1;
+    for (auto& b : noise) {
+        seed = seed * 1103515245 + 12345;
+        b = seed >> 16;
+    }
+    roundTrip(codec, noise);
+
+    size_t len = 0;
+    const uint8_t garbage[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    CHECK(!codec.decompress(garbage, sizeof(garbage), &len));
+    // a failed message leaves the stream usable
+    roundTrip(codec, std::vector<uint8_t>(100, 'a'));
+    printf("zlib codec ok\n");
+    return 0;
+}